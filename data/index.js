@@ -14,6 +14,9 @@ let nrOfMdlColumns = 4;
 let onUICommands = [];
 let model = []; //model.json (as send by the server), used by FindVar
 let savedView = null;
+let channelFrames = {}; //last decoded frame per binary channel, deltas are applied to it
+let subscribedModules = null; //modules (and their binary channels) shown, send to the server so it only sends updates for these
+let subscribeTimeout = null; //the modules arrive one by one: subscribe once they are all rendered
 
 //C++ equivalents
 const UINT8_MAX = 255;
@@ -163,6 +166,10 @@ function makeWS() {
   ws.onmessage = (e)=>{
     if (e.data instanceof ArrayBuffer) { // preview packet
       let buffer = new Uint8Array(e.data);
+      if (buffer[0] & 0x80) { //encoded binary channel frame
+        buffer = decodeFrame(buffer);
+        if (!buffer) return; //delta without a keyframe
+      }
       if (buffer[0] == 0) {
         let canvasNode = gId("Pins.board");
         // console.log(buffer, canvasNode);
@@ -198,8 +205,10 @@ function makeWS() {
             model.push((json)); //this is the model
             addModule(json);
           }
-          else
+          else {
             console.log("html of module already generated", json);
+            subscribeModules(); //reconnected: server needs the subscriptions again
+          }
         }
         else { //update
           if (!Array.isArray(json)) //only the model is an array
@@ -220,6 +229,8 @@ function makeWS() {
   ws.onopen = (e)=>{
     console.log("WS open", e);
 		reqsLegal = true;
+    subscribedModules = null; //new connection, nothing subscribed yet
+    channelFrames = {}; //server starts with keyframes
   }
   ws.onerror = (e)=>{
     console.log("WS error", e);
@@ -805,23 +816,27 @@ function receiveData(json) {
 
         console.log("onDelete ", tableVar, tableNode, rowNr);
 
-      } else if (key == "updRow") { //update the row of a table
+      } else if (key == "updRow") { //update rows of tables: {tableId: {rowNr: [cells]}}
 
-        let tableId = value.id;
-        let pidid = tableId.split(".")
-        let tableVar = controller.modules.findVar(pidid[0], pidid[1]);
-        let rowNr = value.rowNr;
-        let tableRow = value.value;
+        for (let tableId of Object.keys(value)) {
+          let pidid = tableId.split(".")
+          let tableVar = controller.modules.findVar(pidid[0], pidid[1]);
+          if (!tableVar) continue;
 
-        // ppf("receiveData updRow", key, tableId, rowNr, tableRow);
-        // ppf("updRow main", tableId, tableRows, tableNode, tableVar);
+          for (let rowNrS of Object.keys(value[tableId])) {
+            let rowNr = parseInt(rowNrS);
+            let tableRow = value[tableId][rowNrS];
 
-        let colNr = 0;
-        for (let colVar of tableVar.n) {
-          let colValue = tableRow[colNr];
-          // ppf("    col", colNr, colVar, colValue);
-          changeHTML(colVar, {"value":colValue, "chk":"updRow"}, rowNr);
-          colNr++;
+            // ppf("receiveData updRow", key, tableId, rowNr, tableRow);
+
+            let colNr = 0;
+            for (let colVar of tableVar.n) {
+              let colValue = tableRow[colNr];
+              // ppf("    col", colNr, colVar, colValue);
+              changeHTML(colVar, {"value":colValue, "chk":"updRow"}, rowNr);
+              colNr++;
+            }
+          }
         }
 
       } else if (key == "sysInfo") { //update the row of a table
@@ -1704,8 +1719,91 @@ function changeHTMLView(viewName) {
 
   setInstanceTableColumns();
 
+  subscribeModules();
+
 } //changeHTMLView
 
+//tell the server which modules are shown, it will only broadcast updates of these modules (see SysModWeb::subscribe)
+//called after each module added: one subscribe when no module arrived for 100ms, not one command per module
+function subscribeModules() {
+  clearTimeout(subscribeTimeout);
+  subscribeTimeout = setTimeout(sendSubscription, 100);
+}
+
+function sendSubscription() {
+  subscribeTimeout = null;
+  if (!ws || ws.readyState != WebSocket.OPEN) return;
+
+  let modules = [];
+  for (let mdlColumnNode of gId("mdlContainer").childNodes) {
+    if (mdlColumnNode.hidden) continue;
+    for (let divNode of mdlColumnNode.childNodes) {
+      if (divNode.hidden) continue;
+      for (let moduleNode of divNode.childNodes) {
+        if (moduleNode.className && moduleNode.id) {
+          let pidid = moduleNode.id.split(".");
+          if (pidid[0] == "m") modules.push(pidid[1]);
+        }
+      }
+    }
+  }
+
+  //binary channels of the variables in these modules (e.g. Pins.board)
+  let channels = [];
+  let findChannels = (variables) => {
+    for (let variable of variables) {
+      if (variable.channel != null) channels.push(variable.channel);
+      if (variable.n) findChannels(variable.n);
+    }
+  };
+  for (let module of model)
+    if (modules.includes(module.id) && module.n) findChannels(module.n);
+
+  let subscription = JSON.stringify(modules) + JSON.stringify(channels);
+  if (subscription != subscribedModules) {
+    subscribedModules = subscription;
+    var command = {};
+    command.subscribe = modules;
+    command.channels = channels;
+    requestJson(command);
+  }
+}
+
+//[0] 0x80 | channel, [1] type (0 raw, 1 keyframe, 2 delta), [2..3] length of the frame, PackBits of the frame or of frame XOR previous frame
+function decodeFrame(frame) {
+  let channel = frame[0] & 0x7F;
+  let type = frame[1];
+  let len = frame[2] + (frame[3] << 8);
+  let payload = frame.subarray(4);
+  let decoded;
+  if (type == 0)
+    decoded = payload.slice(0, len);
+  else {
+    decoded = new Uint8Array(len);
+    let i = 0;
+    let o = 0;
+    while (i < payload.length && o < len) {
+      let n = payload[i++];
+      if (n < 128) { //n+1 literal bytes
+        decoded.set(payload.subarray(i, i + n + 1), o);
+        i += n + 1;
+        o += n + 1;
+      }
+      else if (n > 128) { //next byte 257-n times
+        decoded.fill(payload[i++], o, o + 257 - n);
+        o += 257 - n;
+      }
+    }
+    if (type == 2) {
+      let prev = channelFrames[channel];
+      if (!prev || prev.length != len) return null;
+      for (let j = 0; j < len; j++) decoded[j] ^= prev[j];
+    }
+  }
+  channelFrames[channel] = decoded;
+  return decoded;
+}
+
 //https://webdesign.tutsplus.com/color-schemes-with-css-variables-and-javascript--cms-36989t
 function changeHTMLTheme(themeName) {
   localStorage.setItem('theme', themeName);
@@ -17,6 +17,8 @@
 #include "SysModSystem.h"
 #include "SysModNetwork.h" //for localIP
 #include "SysModules.h"
+#include "SysStarSync.h"
+#include <unordered_map>
 
 struct DMX {
   byte universe:3; //3 bits / 8
@@ -43,11 +45,13 @@ struct VarData {
 
 //note: changing SysData and jsonData sizes: all instances should have the same version so change with care
 
-struct InstanceInfo {
+struct InstanceInfo: StarSyncPeer { //changes, clock offset and jitter, announce interval and multicast
   IPAddress ip;
-  char name[32];
+  char name[32] = "";
+  uint32_t groupHash = 0; //of the group in the name (group-instance), 0: no group, set by renameInstance
   uint32_t version; //release/version date build
-  unsigned long timeStamp; //when was the package received, used to check on aging
+  unsigned long timeStamp; //when was the package received
+  uint32_t deadline = 0; //when it is removed if no new package received, see expiries
   SysData sysData;
   JsonDocument jsonData;
 };
@@ -100,12 +104,12 @@ struct UDPWLEDSyncMessage { //see notify( in WLED
   char body[1193 - 37]; //41 +(32*36)+0 = 1193
 };
 
-class SysModInstances:public SysModule {
+//the instance sync protocol (StarSync) over UDP, with the dash variables of this app
+class SysModInstances:public SysModule, public StarSync<IPAddress> {
 
 public:
 
-  std::vector<InstanceInfo> instances;
-  std::vector<JsonObject> changedVarsQueue;
+  std::vector<InstanceInfo> instances; //sorted by name
 
   SysModInstances() :SysModule("Instances") {
   };
@@ -113,13 +117,15 @@ public:
   void setup() override {
     SysModule::setup();
 
+    changeSeq = esp_random(); //after a restart receivers do not take the new change messages for old ones
+
     const Variable parentVar = ui->initSysMod(Variable(), name, 3000);
 
     Variable tableVar = ui->initTable(parentVar, "instances", nullptr, true);
     
     ui->initText(tableVar, "name", nullptr, 32, false, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(JsonString(instances[rowNrL].name), rowNrL);
         return true;
       // comment this out for the time being as causes corrupted instance names
@@ -132,7 +138,7 @@ public:
 
     ui->initURL(tableVar, "show", nullptr, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++) {
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++) {
           char urlString[32] = "http://";
           strlcat(urlString, instances[rowNrL].ip.toString().c_str(), sizeof(urlString));
           variable.setValue(JsonString(urlString), rowNrL);
@@ -143,15 +149,15 @@ public:
 
     ui->initNumber(tableVar, "link", UINT16_MAX, 0, UINT16_MAX, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
-          variable.setValue(calcGroup(instances[rowNrL].name), rowNrL);
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+          variable.setValue(groupSize(instances[rowNrL]), rowNrL);
         return true;
       default: return false;
     }});
 
     ui->initText(tableVar, "IP", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(JsonString(instances[rowNrL].ip.toString().c_str()), rowNrL);
         return true;
       default: return false;
@@ -159,17 +165,15 @@ public:
 
     ui->initText(tableVar, "type", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++) {
-          byte type = instances[rowNrL].sysData.type;
-          variable.setValue((type==0)?"WLED":(type==1)?"StarBase":(type==2)?"StarLight":(type==3)?"StarLedsLive":"StarFork", rowNrL);
-        }
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+          variable.setValue(typeName(instances[rowNrL].sysData.type), rowNrL);
         return true;
       default: return false;
     }});
 
     ui->initNumber(tableVar, "version", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].version, rowNrL);
         return true;
       default: return false;
@@ -177,14 +181,14 @@ public:
 
     ui->initNumber(tableVar, "uptime", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].sysData.uptime, rowNrL);
         return true;
       default: return false;
     }});
     ui->initNumber(tableVar, "now", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].sysData.now / 1000, rowNrL);
         return true;
       default: return false;
@@ -192,7 +196,7 @@ public:
 
     ui->initNumber(tableVar, "timestamp", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].sysData.timeSource, rowNrL);
         return true;
       default: return false;
@@ -200,7 +204,7 @@ public:
 
     ui->initNumber(tableVar, "time", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].sysData.tokiTime, rowNrL);
         return true;
       default: return false;
@@ -208,16 +212,37 @@ public:
 
     ui->initNumber(tableVar, "ms", UINT16_MAX, 0, (unsigned long)-1, true, [this](EventArguments) { switch (eventType) {
       case onSetValue:
-        for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
           variable.setValue(instances[rowNrL].sysData.tokiMs, rowNrL);
         return true;
       default: return false;
     }});
 
+    ui->initNumber(tableVar, "offset", UINT16_MAX, INT32_MIN, INT32_MAX, true, [this](EventArguments) { switch (eventType) {
+      case onSetValue:
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+          variable.setValue(instances[rowNrL].clockOffset, rowNrL);
+        return true;
+      default: return false;
+    }});
+
+    ui->initNumber(tableVar, "jitter", UINT16_MAX, 0, INT32_MAX, true, [this](EventArguments) { switch (eventType) {
+      case onSetValue:
+        for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++)
+          variable.setValue(instances[rowNrL].clockJitter, rowNrL);
+        return true;
+      default: return false;
+    }});
+
     //find dash variables and add them to the table
     mdl->findVars("dash", true, [tableVar, this](Variable variable) { //findFun
 
       ppf("dash %s.%s %s found\n", variable.pid(), variable.id(), variable.valueString().c_str());
+
+      uint16_t key = tlvKey(variable.pid(), variable.id());
+      if (dashVars.find(key) != dashVars.end())
+        ppf("dev dash key %s.%s not unique %d\n", variable.pid(), variable.id(), key);
+      dashVars[key] = variable.var;
       // dash Fixture.on 1 found
       // dash Fixture.brightness 94 found
       // dash layers.effect [30] found
@@ -237,7 +262,7 @@ public:
         switch (eventType) { //varEvent
         case onSetValue:
           //should not trigger onChange
-          for (size_t rowNrL = 0; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++) {
+          for (size_t rowNrL = (rowNr == UINT8_MAX)?0:rowNr; rowNrL < instances.size() && (rowNr == UINT8_MAX || rowNrL == rowNr); rowNrL++) {
             // ppf("initVar dash %s[%d]\n", variable.id(), rowNrL);
             //do what setValue is doing except calling onChange
             // insVar["value"][rowNrL] = instances[rowNrL].jsonData[variable.id()]; //only int values...
@@ -279,6 +304,26 @@ public:
 
     }); //findVars
 
+    ui->initText(parentVar, "dashSync", nullptr, 32, true, [this](EventArguments) { switch (eventType) {
+      case onUI:
+        variable.setComment("Binary dash values: announce size, decode time per message, nacks sent and messages resent");
+        return true;
+      case onLoop1s:
+        variable.setValueF("%d B %d cycles %d/%d", announces?announceBytes / announces:0, decodes?(uint32_t)(decodeCycles / decodes):0, nacksSent, retransmits);
+        return true;
+      default: return false;
+    }});
+
+    ui->initCheckBox(parentVar, "multicast", &multicast, false, [this](EventArguments) { switch (eventType) {
+      case onUI:
+        variable.setComment("Dash values only to instances of the same group (group-instance), if all of them have multicast on");
+        return true;
+      case onChange:
+        joinGroup();
+        return true;
+      default: return false;
+    }});
+
     if (sizeof(UDPWLEDMessage) != 44) {
       ppf("dev Size of UDP message is not 44: %d\n", sizeof(UDPWLEDMessage));
       // ppf("udpMessage size %d = %d + %d + %d + ...\n", sizeof(UDPWLEDMessage), sizeof(udpMessage.ip0), sizeof(udpMessage.version), sizeof(udpMessage.name));
@@ -298,10 +343,15 @@ public:
     if (mdls->isConnected && isEnabled) {
       udpConnected = notifierUdp.begin(notifierUDPPort); //sync
       udp2Connected = instanceUDP.begin(instanceUDPPort); //instances
+      joinGroup();
     } else {
       udpConnected = false;
       udp2Connected = false;
+      joinGroup(); //leave
       instances.clear();
+      ipIndex.clear();
+      groups.clear();
+      expiries.clear();
 
       //not needed here as there is no connection
       // ui->processOnUI("instances");
@@ -314,49 +364,86 @@ public:
 
     handleNotifications();
 
-    while (changedVarsQueue.size()) {
-      JsonObject var = changedVarsQueue.front();
-      sendMessageUDP(IPAddress(255, 255, 255, 255), var, var["value"]); //broadcast
-      changedVarsQueue.erase(changedVarsQueue.begin());
-    }
+    sendChanges();
+
+    sendNacks();
 
   }
 
+  void loop1s() override {
+    syncClock();
+
+    //adapts to the number of instances, with jitter
+    if (mdls->isConnected && udp2Connected && (long)(millis() - nextAnnounce) >= 0) {
+      sendSysInfoUDP();
+      nextAnnounce = millis() + announceInterval(instances.size(), esp_random());
+    }
+  }
+
   void loop10s() override {
-    sendSysInfoUDP();  //temporary every second
+    joinGroup(); //name can be changed
   }
 
-  //distract the groupName of an instance name
-  bool groupOfName(const char *name, char *group = nullptr) {
-    char copy[32];
-    strlcpy(copy, name, sizeof(copy));
+  //multicast: also receive group messages of the group of this instance (announced, see groupMulticast)
+  void joinGroup() {
+    uint32_t hash = (multicast && mdls->isConnected && isEnabled)?groupHash(mdl->getValue("System", "name")):0;
+    if (hash == joinedGroupHash) return;
+
+    if (groupConnected) groupUDP.stop();
+    groupConnected = false;
+    joinedGroupHash = hash;
+    if (hash) {
+      groupConnected = groupUDP.beginMulticast(groupIP(), STARSYNC_GROUP_PORT);
+      ppf("instances join group %s %d\n", groupIP().toString().c_str(), groupConnected);
+    }
+  }
 
-    char * token = strtok(copy, "-"); //before minus
+  IPAddress groupIP() {
+    byte address[4];
+    groupAddress(joinedGroupHash, address);
+    return IPAddress(address[0], address[1], address[2], address[3]);
+  }
 
-    //check if group
-    if (token != nullptr) {
-      // ppf("groupOfName 1:%s 2:%s 3:%s 4:%s 5:%s\n",name, strnstr(name, "-", 32), name, strtok(name, "-"), name?name:"X"); 
-      token = strtok(nullptr, "-"); //after -
-      if (token != nullptr) {
-        // ppf("groupOfName g:%s i:%s\n", copy, token); 
-        if (group) strlcpy(group, copy, sizeof(copy)); //group has same size!
-        return true;
+  //now (millis() + timebase) in µs, wrapping: the clock synced between the instances of a group
+  uint32_t syncMicros() {
+    return micros() + sys->timebase * 1000;
+  }
+
+  //the StarBase instance with the lowest ip in the group is the clock master
+  IPAddress findClockMaster() {
+    IPAddress master = net->localIP();
+    for (const InstanceInfo &instance: instances) {
+      if (instance.sysData.type == 0 || !sameGroup(instance)) continue; //WLED does not answer clock requests
+      for (uint8_t i = 0; i < 4; i++) {
+        if (instance.ip[i] != master[i]) {
+          if (instance.ip[i] < master[i]) master = instance.ip;
+          break;
+        }
       }
     }
-    return false;
+    return master;
+  }
+
+  //ntp style: ask the master its time each second
+  void syncClock() {
+    if (!mdls->isConnected || !udp2Connected) return;
 
+    IPAddress master = findClockMaster();
+    requestClock(master, master == net->localIP());
   }
 
-  // identify if an instance belongs to a group: 0: no, 1: group of 1, >1: group with more
-  uint8_t calcGroup(const char * insName) {
-    uint8_t calc = 0;
-    for (InstanceInfo &instance: instances) {
-      char group1[32];
-      char group2[32];
-      if (groupOfName(instance.name, group1) && groupOfName(insName, group2) && strncmp(group1, group2, sizeof(group1)) == 0)
-        calc++;
-    }
-    return calc++;
+  //same group as this instance: the hash first, the group itself if equal
+  bool sameGroup(const InstanceInfo &instance) {
+    if (!instance.groupHash) return false;
+    InstanceInfo *self = findInstance(net->localIP(), false);
+    const char *name = self?self->name:mdl->getValue("System", "name").as<const char *>(); //self: not yet before the first sendSysInfoUDP
+    return instance.groupHash == (self?self->groupHash:groupHash(name)) && sameGroupName(instance.name, name);
+  }
+
+  //instances in the group of this instance, 0: no group
+  uint8_t groupSize(const InstanceInfo &instance) {
+    GroupInfo *group = findGroup(instance);
+    return group?group->size:0;
   }
 
   #define PRESUMED_NETWORK_DELAY 3 //how many ms could it take on avg to reach the receiver? This will be added to transmitted times
@@ -390,6 +477,7 @@ public:
 
           ppf("   %d %d p:%d\n", wledSyncMessage.bri, wledSyncMessage.mainsegMode, packetSize); //LEDs specific
 
+          bool instanceFound = findInstance(notifierUdp.remoteIP(), false) != nullptr;
           InstanceInfo *instance = findInstance(notifierUdp.remoteIP()); //if not exist, created
 
           // instance->sysData.uptime = (wledSyncMessage.now[0] * 256*256*256 + 256*256*wledSyncMessage.now[1] + 256*wledSyncMessage.now[2] + wledSyncMessage.now[3]) / 1000;
@@ -439,8 +527,12 @@ public:
           // Serial.println();
 
           ppf("instances handleNotifications %d\n", notifierUdp.remoteIP()[3]);
-          for (JsonObject childVar: Variable("Instances", "instances").children())
-            Variable(childVar).triggerEvent(onSetValue); //set the value (WIP) ); //rowNr //instance - instances.begin()
+          if (instanceFound)
+            updateRow(*instance);
+          else {
+            for (JsonObject childVar: Variable("Instances", "instances").children())
+              Variable(childVar).triggerEvent(onSetValue); //new row, update all
+          }
 
           web->recvUDPCounter++;
           web->recvUDPBytes+=packetSize;
@@ -456,98 +548,126 @@ public:
     if (udp2Connected) {
       packetSize = instanceUDP.parsePacket();
 
-      if (packetSize > 0) {
-        // IPAddress remoteIp = instanceUDP.remoteIP();
-        // ppf("handleNotifications instances ...%d %d check %d or %d\n", instanceUDP.remoteIP()[3], packetSize, sizeof(UDPWLEDMessage), sizeof(UDPStarMessage));
-
-        bool found = false;
+      if (packetSize > 0)
+        handleInstancePacket(instanceUDP, packetSize);
+    }
 
-        if (packetSize == sizeof(UDPWLEDMessage)) { //WLED instance
-          UDPStarMessage starMessage;
-          byte *udpIn = (byte *)&starMessage.header;
-          instanceUDP.read(udpIn, packetSize);
+    //handle group messages (multicast)
+    if (groupConnected) {
+      packetSize = groupUDP.parsePacket();
 
-          // ppf("WLED instance %s received: size: %d\n", instanceUDP.remoteIP().toString().c_str(), packetSize);
-          // for (int i=0; i<44; i++) {
-          //   Serial.printf("%d: %d\n", i, udpIn[i]);
-          // }
+      if (packetSize > 0)
+        handleInstancePacket(groupUDP, packetSize);
+    }
 
-          starMessage.sysData.type = 0; //WLED
+    //remove inactive instances: only the earliest deadlines are checked
+    bool erased = false;
+    uint32_t deadline;
+    uint32_t ip;
+    while (expiries.popExpired(millis(), deadline, ip)) {
+      auto found = ipIndex.find(ip);
+      if (found == ipIndex.end() || instances[found->second].deadline != deadline) continue; //renewed or already removed
+      size_t index = found->second;
+      removeFromGroup(instances[index]);
+      ipIndex.erase(found);
+      instances.erase(instances.begin() + index);
+      updateIndex(index, instances.size());
+      erased = true;
+    }
+    if (erased) {
+      ppf("instances remove inactive instances\n");
+      for (JsonObject childVar: Variable("Instances", "instances").children())
+        Variable(childVar).triggerEvent(onSetValue); //set the value (WIP)); //no rowNr so all rows updated
 
-          if (starMessage.header.ip0 == net->localIP()[0]) { // checksum - no other type of message
-            updateInstance(starMessage);
-            found = true;
-          }
-        }
+      //tbd: pubsub mechanism
+      //LEDs specific
+      Variable("DDP", "instance").triggerEvent(onUI); //rebuild options
+      // Variable("Artnet", "artInst").triggerEvent(onUI); //rebuild options
+    }
+  }
 
-        if (!found && packetSize == sizeof(UDPStarMessage)) { //StarBase instance
-          UDPStarMessage starMessage;
-          byte *udpIn = (byte *)&starMessage;
-          instanceUDP.read(udpIn, packetSize);
+  //announces, dash value changes and json messages of instances
+  void handleInstancePacket(WiFiUDP &udp, int packetSize) {
+    uint32_t received = syncMicros(); //clock t2 or t4
+    // IPAddress remoteIp = udp.remoteIP();
+    // ppf("handleNotifications instances ...%d %d check %d or %d\n", udp.remoteIP()[3], packetSize, sizeof(UDPWLEDMessage), sizeof(UDPStarMessage));
 
-          // ppf("Star instance %s received: size: %d\n", instanceUDP.remoteIP().toString().c_str(), packetSize);
+    bool found = false;
 
-          if (starMessage.header.ip0 == net->localIP()[0]) { // checksum - no other type of message
-            updateInstance(starMessage);
-            found = true;
-          }
-        }
+    if (packetSize == sizeof(UDPWLEDMessage)) { //WLED instance
+      UDPStarMessage starMessage;
+      byte *udpIn = (byte *)&starMessage.header;
+      udp.read(udpIn, packetSize);
 
-        if (!found) { // check on json
-          char buffer[packetSize];
-          instanceUDP.read(buffer, packetSize);
+      // ppf("WLED instance %s received: size: %d\n", udp.remoteIP().toString().c_str(), packetSize);
+      // for (int i=0; i<44; i++) {
+      //   Serial.printf("%d: %d\n", i, udpIn[i]);
+      // }
 
-          JsonDocument message;
-          DeserializationError error = deserializeJson(message, buffer);
-          if (error)
-            ppf("handleNotifications i:%d no json l: %d e:%s\n", instanceUDP.remoteIP()[3], strnlen(buffer, packetSize), error.c_str());
-          else {
-            if (instanceUDP.remoteIP()[3] != net->localIP()[3]) { //only others
+      starMessage.sysData.type = 0; //WLED
 
-              InstanceInfo *instance = findInstance(instanceUDP.remoteIP()); //if not exist, created
-              char group1[32];
-              char group2[32];
-              if (groupOfName(instance->name, group1) && groupOfName(mdl->getValue("System", "name"), group2) && strncmp(group1, group2, sizeof(group1)) == 0) {
-                  if (!message["id"].isNull() && !message["value"].isNull()) {
-                    ppf("handleNotifications i:%d json message %.*s l:%d\n", instanceUDP.remoteIP()[3], packetSize, buffer, packetSize);
+      if (starMessage.header.ip0 == net->localIP()[0]) { // checksum - no other type of message
+        updateInstance(starMessage);
+        found = true;
+      }
+    }
 
-                    Variable(message["pid"].as<const char *>(), message["id"].as<const char *>()).setValueJV(message["value"]);
-                  }
-                }
-              }
-            else
-              ppf("handleNotifications self i:%d b:%.*s\n", instanceUDP.remoteIP()[3], packetSize, buffer);
-          }
-        }
+    //StarBase instance: json payload (always sizeof(UDPStarMessage)), binary payload (only the bytes used) or no payload (multicast)
+    if (!found && packetSize >= offsetof(UDPStarMessage, jsonString) && packetSize <= sizeof(UDPStarMessage) && udp.peek() == 255) {
+      UDPStarMessage starMessage;
+      byte *udpIn = (byte *)&starMessage;
+      udp.read(udpIn, packetSize);
 
-        web->recvUDPCounter++;
-        web->recvUDPBytes+=packetSize;
+      // ppf("Star instance %s received: size: %d\n", udp.remoteIP().toString().c_str(), packetSize);
 
-      } //packetSize
-      else {
+      if (starMessage.header.ip0 == net->localIP()[0]) { // checksum - no other type of message
+        updateInstance(starMessage, packetSize);
+        found = true;
       }
-    } //udp2Connected
+    }
 
-    //remove inactive instances
-    bool erased = false;
-    for (std::vector<InstanceInfo>::iterator instance=instances.begin(); instance!=instances.end(); ) {
-      if (millis() - instance->timeStamp > 32000) { //assuming a ping each 30 seconds
-        instance = instances.erase(instance);
-        erased = true;
+    if (!found && udp.peek() == STARSYNC_MAGIC) { //dash value changes
+      byte buffer[packetSize];
+      udp.read(buffer, packetSize);
+
+      InstanceInfo *instance = findInstance(udp.remoteIP(), false); //changes of unknown instances are ignored till announced
+      if (instance && udp.remoteIP() != net->localIP() && sameGroup(*instance)) {
+        uint32_t cycles = ESP.getCycleCount();
+        if (!receive(udp.remoteIP(), *instance, buffer, packetSize, received))
+          ppf("dev handleInstancePacket ip:%d payload not valid s:%d\n", instance->ip[3], packetSize);
+        decodeCycles += ESP.getCycleCount() - cycles;
+        decodes++;
       }
-      else
-        ++instance;
+      found = true;
     }
-    if (erased) {
-      ppf("instances remove inactive instances\n");
-      for (JsonObject childVar: Variable("Instances", "instances").children())
-        Variable(childVar).triggerEvent(onSetValue); //set the value (WIP)); //no rowNr so all rows updated
 
-      //tbd: pubsub mechanism
-      //LEDs specific
-      Variable("DDP", "instance").triggerEvent(onUI); //rebuild options
-      // Variable("Artnet", "artInst").triggerEvent(onUI); //rebuild options
+    if (!found) { // check on json
+      char buffer[packetSize];
+      udp.read(buffer, packetSize);
+
+      JsonDocument message;
+      DeserializationError error = deserializeJson(message, buffer);
+      if (error)
+        ppf("handleNotifications i:%d no json l: %d e:%s\n", udp.remoteIP()[3], strnlen(buffer, packetSize), error.c_str());
+      else {
+        if (udp.remoteIP()[3] != net->localIP()[3]) { //only others
+
+          InstanceInfo *instance = findInstance(udp.remoteIP()); //if not exist, created
+          if (sameGroup(*instance)) {
+              if (!message["id"].isNull() && !message["value"].isNull()) {
+                ppf("handleNotifications i:%d json message %.*s l:%d\n", udp.remoteIP()[3], packetSize, buffer, packetSize);
+
+                Variable(message["pid"].as<const char *>(), message["id"].as<const char *>()).setValueJV(message["value"]);
+              }
+            }
+          }
+        else
+          ppf("handleNotifications self i:%d b:%.*s\n", udp.remoteIP()[3], packetSize, buffer);
+      }
     }
+
+    web->recvUDPCounter++;
+    web->recvUDPBytes+=packetSize;
   }
 
   void sendSysInfoUDP()
@@ -610,26 +730,39 @@ public:
     updateInstance(starMessage); //temp? to show own instance in list as instance is not catching it's own udp message...
 
     //other way around: first set instance variables, then fill starMessage
-    for (InstanceInfo &instance: instances) {
-      if (instance.ip == net->localIP()) {
-        instance.jsonData.to<JsonObject>(); //clear
-
-        //send dash values
-        mdl->findVars("dash", true, [&instance](Variable variable) { //varEvent
-          instance.jsonData[variable.id()] = variable.value();
-          // // print->printJson("setVar", var);
-          // JsonArray valArray = variable.valArray();
-          // if (valArray.isNull())
-          // else if (valArray.size())
-          //   instance.jsonData[variable.id()] = valArray;
-        });
-
-        serializeJson(instance.jsonData, starMessage.jsonString);
-        // ppf("sendSysInfoUDP ip:%d s:%s\n", instance.ip[3], starMessage.jsonString);
-        // print->printJson(" d:", instance.jsonData);
-        // print->printJDocInfo("   info", instance.jsonData);
+    size_t packetSize = offsetof(UDPStarMessage, jsonString);
+    InstanceInfo *self = findInstance(net->localIP(), false);
+    if (self) {
+      InstanceInfo &instance = *self;
+      instance.jsonData.to<JsonObject>(); //clear
+      for (auto &dashVar: dashVars) {
+        Variable variable = Variable(dashVar.second);
+        instance.jsonData[variable.id()] = variable.value();
+      }
+      instance.clockOffset = clock.offset();
+      instance.clockJitter = clock.jitter();
+
+      //binary dash payload
+      packetSize += writeAnnounce((byte *)starMessage.jsonString, sizeof(starMessage.jsonString), instances.size());
+      // ppf("sendSysInfoUDP ip:%d s:%d\n", instance.ip[3], packetSize);
+      // print->printJson(" d:", instance.jsonData);
+    }
+
+    //multicast: the dash values only to the group, the rest (for the instances table and WLED) to all
+    bool toGroup = groupMulticast();
+    size_t broadcastSize = toGroup?offsetof(UDPStarMessage, jsonString):packetSize;
+    if (toGroup && packetSize > broadcastSize) {
+      if (0 != instanceUDP.beginPacket(groupIP(), STARSYNC_GROUP_PORT)) {
+        instanceUDP.write((byte*)&starMessage, packetSize);
+        web->sendUDPCounter++;
+        web->sendUDPBytes+=packetSize;
+        instanceUDP.endPacket();
       }
+      else
+        ppf("sendSysInfoUDP group error\n");
     }
+    if (toGroup) //the others only need to know when to expect the next announce
+      broadcastSize += writeAnnounce((byte *)starMessage.jsonString, sizeof(starMessage.jsonString), instances.size(), true);
 
     // broadcast to network
     if (0 != instanceUDP.beginPacket(IPAddress(255, 255, 255, 255), instanceUDPPort)) {  // WLEDMM beginPacket == 0 --> error
@@ -639,10 +772,12 @@ public:
       //   Serial.printf("%d: %d - %c\n", x, xx[x], xx[x]);
       // }
 
-      instanceUDP.write((byte*)&starMessage, sizeof(UDPStarMessage));
+      instanceUDP.write((byte*)&starMessage, broadcastSize);
       web->sendUDPCounter++;
-      web->sendUDPBytes+=sizeof(UDPStarMessage);
+      web->sendUDPBytes+=broadcastSize;
       instanceUDP.endPacket();
+      announces++;
+      announceBytes += packetSize;
     }
     else {
       ppf("sendSysInfoUDP error\n");
@@ -664,6 +799,25 @@ public:
     // }
   }
 
+  //called by Variable::triggerEvent on onChange of a dash variable
+  void queueChange(Variable variable) {
+    if (applyingValues) return; //received from another instance: do not echo
+    uint16_t key = tlvKey(variable.pid(), variable.id());
+    if (dashVars.find(key) == dashVars.end()) dashVars[key] = variable.var; //created after setup
+    StarSync::queueChange(key);
+  }
+
+  void sendTLV(IPAddress ip, uint16_t port, const byte *buffer, size_t len) {
+    if (0 != instanceUDP.beginPacket(ip, port)) {
+      instanceUDP.write(buffer, len);
+      web->sendUDPCounter++;
+      web->sendUDPBytes+=len;
+      instanceUDP.endPacket();
+    }
+    else
+      ppf("sendTLV error ip:%d\n", ip[3]);
+  }
+
   //sends an UDP message to a specific ip. Broadcast?
   void sendMessageUDP(IPAddress ip, JsonObject var, JsonVariant value) {
     if (0 != instanceUDP.beginPacket(ip, instanceUDPPort)) {
@@ -687,145 +841,132 @@ public:
     }
   }
 
-  void updateInstance( UDPStarMessage udpStarMessage) {
+  void updateInstance( UDPStarMessage udpStarMessage, size_t packetSize = sizeof(UDPStarMessage)) {
     IPAddress messageIP = IPAddress(udpStarMessage.header.ip0, udpStarMessage.header.ip1, udpStarMessage.header.ip2, udpStarMessage.header.ip3);
 
-    bool instanceFound = false;
-    for (InstanceInfo &instance : instances) {
-      if (instance.ip == messageIP)
-        instanceFound = true;
-    }
+    InstanceInfo *found = findInstance(messageIP, false);
+    bool instanceFound = found != nullptr;
+    bool rowMoved = !instanceFound || strncmp(found->name, udpStarMessage.header.name, sizeof(found->name)) != 0; //renamed: resorted and groups changed
 
     // ppf("updateInstance Instance: ...%d n:%s found:%d\n", messageIP[3], udpStarMessage.header.name, instanceFound);
 
-    if (!instanceFound) { //new instance
-      InstanceInfo instance;
-      instance.ip = messageIP;
-      if (udpStarMessage.sysData.type == 0) {//WLED only
-        instance.sysData.type = 0; //WLED
-        //updated in udp sync message:
-        instance.sysData.uptime = 0;
-        instance.sysData.dmx.universe = 0;
-        instance.sysData.dmx.start = 0;
-        instance.sysData.dmx.count = 0;
-        //dash values default 0
-        instance.jsonData.to<JsonObject>();
-      }
-
-      instances.push_back(instance);
-      std::sort(instances.begin(),instances.end(), [](InstanceInfo &a, InstanceInfo &b){ return strncmp(a.name,b.name, sizeof(a.name))<0; });
+    //update the instance in the instances array with the message data
+    InstanceInfo &instance = *renameInstance(findInstance(messageIP), udpStarMessage.header.name); //new instance created
+
+    if (!instanceFound && udpStarMessage.sysData.type == 0) {//WLED only
+      instance.sysData.type = 0; //WLED
+      //updated in udp sync message:
+      instance.sysData.uptime = 0;
+      instance.sysData.dmx.universe = 0;
+      instance.sysData.dmx.start = 0;
+      instance.sysData.dmx.count = 0;
+      //dash values default 0
+      instance.jsonData.to<JsonObject>();
     }
 
-    //update the instance in the instances array with the message data
+    //update instance from StarMessage
+    instance.timeStamp = millis(); //update timestamp (when was the package received)
+    if (udpStarMessage.sysData.type >= 1 && instance.ip != net->localIP()) //own payload not filled yet
+      instance.interval = announcedInterval((byte *)udpStarMessage.jsonString, packetSize - offsetof(UDPStarMessage, jsonString));
+    renewDeadline(instance);
+    instance.version = udpStarMessage.header.version;
 
-    // uint8_t rowNr = 0;
-    for (InstanceInfo &instance: instances) {
-      if (instance.ip == messageIP) {
-        //update instance from StarMessage
-        instance.timeStamp = millis(); //update timestamp (when was the package received)
-        strlcpy(instance.name, udpStarMessage.header.name, sizeof(instance.name));
-        instance.version = udpStarMessage.header.version;
-
-        if (instance.ip == net->localIP()) {
-          esp_wifi_get_mac((wifi_interface_t)ESP_IF_WIFI_STA, instance.sysData.macAddress);
-          // ppf("macaddress %02X:%02X:%02X:%02X:%02X:%02X\n", instance.macAddress[0], instance.macAddress[1], instance.macAddress[2], instance.macAddress[3], instance.macAddress[4], instance.macAddress[5]);
-        }
+    if (instance.ip == net->localIP()) {
+      esp_wifi_get_mac((wifi_interface_t)ESP_IF_WIFI_STA, instance.sysData.macAddress);
+      // ppf("macaddress %02X:%02X:%02X:%02X:%02X:%02X\n", instance.macAddress[0], instance.macAddress[1], instance.macAddress[2], instance.macAddress[3], instance.macAddress[4], instance.macAddress[5]);
+    }
 
-        if (udpStarMessage.sysData.type >= 1) {//StarBase, StarLight and forks only
-          instance.sysData = udpStarMessage.sysData;
-
-          if (instance.ip != net->localIP()) { //send from localIP will be done after updateInstance
-            char group1[32];
-            char group2[32];
-            if (groupOfName(instance.name, group1) && groupOfName(mdl->getValue("System", "name"), group2) && strncmp(group1, group2, sizeof(group1)) == 0) {
-
-              uint32_t t = instance.sysData.now;
-              t += PRESUMED_NETWORK_DELAY; //adjust trivially for network delay
-              t -= millis();
-              sys->timebase = t;
-              // timebaseUpdated = true;
-
-              Toki::Time tm;
-              tm.sec = instance.sysData.tokiTime;
-              tm.ms = instance.sysData.tokiMs;
-              if (instance.sysData.timeSource > sys->toki.getTimeSource() || sys->toki.getTimeSource() == TOKI_TS_NONE) { //if sender's time source is more accurate
-                sys->toki.adjust(tm, PRESUMED_NETWORK_DELAY); //adjust trivially for network delay
-                uint8_t ts = TOKI_TS_UDP; //5
-                if (instance.sysData.timeSource > 99) ts = TOKI_TS_UDP_NTP; //110
-                else if (instance.sysData.timeSource >= TOKI_TS_SEC) ts = TOKI_TS_UDP_SEC; //20
-                sys->toki.setTime(tm, ts);
-              } else if (/*timebaseUpdated && */ sys->toki.getTimeSource() > 99) { //if we both have good times, get a more accurate timebase
-                Toki::Time myTime = sys->toki.getTime();
-                uint32_t diff = sys->toki.msDifference(tm, myTime);
-                sys->timebase -= PRESUMED_NETWORK_DELAY; //no need to presume, use difference between NTP times at send and receive points
-                if (sys->toki.isLater(tm, myTime)) {
-                  sys->timebase += diff;
-                } else {
-                  sys->timebase -= diff;
-                }
-              }
+    if (udpStarMessage.sysData.type >= 1) {//StarBase, StarLight and forks only
+      if (instanceFound && udpStarMessage.sysData.uptime < instance.sysData.uptime) { //restarted: its sequence numbers start again
+        ppf("instances restarted %s\n", messageIP.toString().c_str());
+        restarted(instance);
+      }
+      instance.sysData = udpStarMessage.sysData;
 
-              //set instance.jsonData from new string
-              JsonDocument newData;
-              DeserializationError error = deserializeJson(newData, udpStarMessage.jsonString);
-              if (error || !newData.is<JsonObject>()) {
-                // ppf("dev updateInstance json failed ip:%d e:%s\n", instance.ip[3], error.c_str(), udpStarMessage.jsonString);
-                //failed because some instances not on latest firmware, so turned off temporarily (tbd/wip)
-              }
-              else {
-                //check if instance belongs to the same group
+      if (instance.ip != net->localIP()) { //send from localIP will be done after updateInstance
+        if (sameGroup(instance)) {
 
-                for (JsonPair pair: newData.as<JsonObject>()) {
-                  // ppf("updateInstance sync from i:%s k:%s v:%s\n", instance.name, pair.key().c_str(), pair.value().as<String>().c_str());
+          if (!clock.valid() && instance.ip == findClockMaster()) { //till the clock sync with the group master has a sample
+            uint32_t t = instance.sysData.now;
+            t += PRESUMED_NETWORK_DELAY; //adjust trivially for network delay
+            t -= millis();
+            sys->timebase = t;
+            // timebaseUpdated = true;
+          }
 
-                  char pid[32];
-                  strlcpy(pid, pair.key().c_str(), sizeof(pid));
-                  char * id = strtok(pid, ".");
-                  if (id != nullptr ) {
-                    strlcpy(pid, id, sizeof(pid)); //copy the id part
-                    id = strtok(nullptr, "."); //the rest after .
-                  }
+          Toki::Time tm;
+          tm.sec = instance.sysData.tokiTime;
+          tm.ms = instance.sysData.tokiMs;
+          if (instance.sysData.timeSource > sys->toki.getTimeSource() || sys->toki.getTimeSource() == TOKI_TS_NONE) { //if sender's time source is more accurate
+            sys->toki.adjust(tm, PRESUMED_NETWORK_DELAY); //adjust trivially for network delay
+            uint8_t ts = TOKI_TS_UDP; //5
+            if (instance.sysData.timeSource > 99) ts = TOKI_TS_UDP_NTP; //110
+            else if (instance.sysData.timeSource >= TOKI_TS_SEC) ts = TOKI_TS_UDP_SEC; //20
+            sys->toki.setTime(tm, ts);
+          } else if (/*timebaseUpdated && */ sys->toki.getTimeSource() > 99) { //if we both have good times, get a more accurate timebase
+            Toki::Time myTime = sys->toki.getTime();
+            uint32_t diff = sys->toki.msDifference(tm, myTime);
+            sys->timebase -= PRESUMED_NETWORK_DELAY; //no need to presume, use difference between NTP times at send and receive points
+            if (sys->toki.isLater(tm, myTime)) {
+              sys->timebase += diff;
+            } else {
+              sys->timebase -= diff;
+            }
+          }
 
-                  Variable(pid, id).setValueJV(pair.value());
+          size_t payloadSize = packetSize - offsetof(UDPStarMessage, jsonString);
+          if (TLVReader::isTLV((byte *)udpStarMessage.jsonString, payloadSize)) {
+            uint32_t cycles = ESP.getCycleCount();
+            if (!receiveAnnounce(instance, (byte *)udpStarMessage.jsonString, payloadSize))
+              ppf("dev updateInstance ip:%d payload not valid s:%d\n", instance.ip[3], payloadSize);
+            decodeCycles += ESP.getCycleCount() - cycles;
+            decodes++;
+          }
+          else if (payloadSize) { //no payload: multicast mode sends the dash values to the group only (if all receive it)
+            //set instance.jsonData from new string (instances not on the binary payload yet)
+            JsonDocument newData;
+            DeserializationError error = deserializeJson(newData, udpStarMessage.jsonString, payloadSize);
+            if (error || !newData.is<JsonObject>()) {
+              // ppf("dev updateInstance json failed ip:%d e:%s\n", instance.ip[3], error.c_str(), udpStarMessage.jsonString);
+              //failed because some instances not on latest firmware, so turned off temporarily (tbd/wip)
+            }
+            else {
+              //check if instance belongs to the same group
+
+              for (JsonPair pair: newData.as<JsonObject>()) {
+                // ppf("updateInstance sync from i:%s k:%s v:%s\n", instance.name, pair.key().c_str(), pair.value().as<String>().c_str());
+
+                char pid[32];
+                strlcpy(pid, pair.key().c_str(), sizeof(pid));
+                char * id = strtok(pid, ".");
+                if (id != nullptr ) {
+                  strlcpy(pid, id, sizeof(pid)); //copy the id part
+                  id = strtok(nullptr, "."); //the rest after .
                 }
-                instance.jsonData = newData; // deepcopy: https://github.com/bblanchon/ArduinoJson/issues/1023
-                // ppf("updateInstance json ip:%d", instance.ip[3]);
-                // print->printJson(" d:", instance.jsonData);
+
+                Variable(pid, id).setValueJV(pair.value());
               }
+              instance.jsonData = newData; // deepcopy: https://github.com/bblanchon/ArduinoJson/issues/1023
+              // ppf("updateInstance json ip:%d", instance.ip[3]);
+              // print->printJson(" d:", instance.jsonData);
             }
-          } //same group
-        }
-
-        //only update cell in instbl!
-        //create a json string
-        //send the json
-        //ui to parse the json
-
-        if (instanceFound) {
-          // JsonObject responseObject = web->getResponseObject();
-
-          // responseObject["updRow"]["id"] = "instances";
-          // responseObject["updRow"]["rowNr"] = rowNr;
-          // responseObject["updRow"]["value"].to<JsonArray>();
-          // addTblRow(responseObject["updRow"]["value"], instance);
-
-          // web->sendResponseObject();
-
-          // ppf("updateInstance updRow\n");
-
-          for (JsonObject childVar: Variable("Instances", "instances").children())
-            Variable(childVar).triggerEvent(onSetValue); //set the value (WIP)); //rowNr instance - instances.begin()
-
-          //tbd: now done for all rows, should be done only for updated rows!
+          }
         }
+      } //same group
+    }
 
-      } //ip
-      // rowNr++;
-    } // for instances
+    if (!rowMoved)
+      updateRow(instance); //only the cells of this instance
+    else if (instanceFound) {
+      for (JsonObject childVar: Variable("Instances", "instances").children())
+        Variable(childVar).triggerEvent(onSetValue); //rows shifted, update all
+    }
 
     if (!instanceFound) {
       ppf("instances new instance %s\n", messageIP.toString().c_str());
 
+      announceFull = true; //so it gets all dash values at the next announce
+
       //tbd: pubsub mechanism
       //LEDs specific
       Variable("DDP", "instance").triggerEvent(onUI); //rebuild options
@@ -843,33 +984,219 @@ public:
     }
   }
 
-  InstanceInfo * findInstance(IPAddress ip) {
+  //StarSync: the transport, the clock and the dash variables
+
+  uint32_t localMillis() override {return millis();}
+  uint32_t clockMicros() override {return syncMicros();}
+  void adjustClock(int32_t ms) override {sys->timebase += ms;}
+
+  void sendTo(IPAddress ip, const uint8_t *data, size_t len) override {
+    sendTLV(ip, instanceUDPPort, data, len);
+  }
+
+  //multicast: only to the group
+  void sendToGroup(const uint8_t *data, size_t len, bool multicast) override {
+    if (multicast)
+      sendTLV(groupIP(), STARSYNC_GROUP_PORT, data, len);
+    else
+      sendTLV(IPAddress(255, 255, 255, 255), instanceUDPPort, data, len);
+  }
+
+  bool multicastJoined() override {return groupConnected;}
 
-    bool instanceFound = false;
-    for (InstanceInfo &instance : instances) {
-      if (instance.ip == ip)
-        instanceFound = true;
+  //WLED instances do not sync dash values
+  void forGroupPeers(std::function<void(IPAddress, StarSyncPeer &)> fun) override {
+    for (InstanceInfo &instance: instances)
+      if (instance.sysData.type != 0 && instance.ip != net->localIP() && sameGroup(instance)) fun(instance.ip, instance);
+  }
+
+  void forValues(std::function<void(uint16_t)> fun) override {
+    for (auto &dashVar: dashVars) fun(dashVar.first);
+  }
+
+  //binary dash payload: the value of a dash variable as TLV
+  bool encodeValue(uint16_t key, TLVData &value) override {
+    auto dashVar = dashVars.find(key);
+    if (dashVar == dashVars.end()) return false;
+    JsonVariant variant = Variable(dashVar->second).value();
+
+    const char *text = nullptr;
+    String json; //arrays and objects
+    if (variant.isNull()) {value.type = tlvNull; value.len = 0;}
+    else if (variant.is<bool>()) {value.type = tlvBool; value.data[0] = variant.as<bool>(); value.len = 1;}
+    else if (variant.is<uint32_t>()) {value.type = tlvUInt; value.len = TLVWriter::encodeUInt(variant.as<uint32_t>(), value.data);}
+    else if (variant.is<int32_t>()) {value.type = tlvInt; value.len = TLVWriter::encodeInt(variant.as<int32_t>(), value.data);}
+    else if (variant.is<float>()) {value.type = tlvFloat; float f = variant.as<float>(); memcpy(value.data, &f, sizeof(float)); value.len = sizeof(float);}
+    else if (variant.is<const char *>()) {value.type = tlvString; text = variant.as<const char *>();}
+    else {value.type = tlvJson; serializeJson(variant, json); text = json.c_str();}
+
+    if (text) {
+      value.len = strlen(text);
+      if (value.len > sizeof(value.data)) return false; //does not fit in a TLV entry
+      memcpy(value.data, text, value.len);
     }
+    return true;
+  }
 
-    if (!instanceFound) { //instance always found
-      InstanceInfo instance;
-      instance.ip = ip;
-      instances.push_back(instance);
-      std::sort(instances.begin(),instances.end(), [](InstanceInfo &a, InstanceInfo &b){ return strncmp(a.name,b.name, sizeof(a.name))<0; });
+  //binary dash payload: set a received value, in the instances table and in the dash variable
+  void applyValue(StarSyncPeer &peer, const TLVValue &tlv, bool clear) override {
+    InstanceInfo &instance = static_cast<InstanceInfo &>(peer);
+    if (clear) instance.jsonData.to<JsonObject>(); //full message: only its values
+
+    auto dashVar = dashVars.find(tlv.key);
+    if (dashVar == dashVars.end()) return; //not a dash variable in this app
+
+    Variable variable = Variable(dashVar->second);
+    JsonVariant value = instance.jsonData[variable.id()].to<JsonVariant>();
+    switch (tlv.type) {
+      case tlvBool: value.set(tlv.asUInt() != 0); break;
+      case tlvUInt: value.set(tlv.asUInt()); break;
+      case tlvInt: value.set(tlv.asInt()); break;
+      case tlvFloat: value.set(tlv.asFloat()); break;
+      case tlvString: value.set(JsonString((const char *)tlv.data, tlv.len, JsonString::Copied)); break;
+      case tlvJson: {
+        JsonDocument doc;
+        if (!deserializeJson(doc, (const char *)tlv.data, tlv.len)) value.set(doc.as<JsonVariant>());
+        break; }
+      default: break; //tlvNull and unknown types
     }
+    if (!value.isNull()) variable.setValueJV(value);
+  }
+
+  //adds an updRow with the cells of this instance to the response, the other rows stay untouched
+  //send by web->flushResponses together with the other changes, only to clients subscribed to the table
+  void updateRow(InstanceInfo &instance) {
+    size_t rowNr = &instance - instances.data();
+
+    char rowNrS[4];
+    print->fFormat(rowNrS, sizeof(rowNrS), "%d", (int)rowNr);
+    JsonArray row = web->getResponseObject()["updRow"]["Instances.instances"][rowNrS].to<JsonArray>(); //replaces an unsent update of this row
+    addTblRow(row, instance);
 
-    // InstanceInfo foundInstance;
-    //iterate vector pointers so we can update the instances
-    for (InstanceInfo &instance : instances) {
-      if (instance.ip == ip) {
-        return &instance;
+    //keep the model in sync for new clients, without sending the whole columns
+    size_t colNr = 0;
+    for (JsonObject childVar: Variable("Instances", "instances").children())
+      childVar["value"][rowNr] = row[colNr++];
+  }
+
+  //the cells of an instance in the column order of the instances table
+  void addTblRow(JsonArray row, InstanceInfo &instance) {
+    for (JsonObject childVar: Variable("Instances", "instances").children()) {
+      const char *id = childVar["id"];
+      if (strcmp(id, "name") == 0) row.add(instance.name); //copied
+      else if (strcmp(id, "show") == 0) {
+        char urlString[32] = "http://";
+        strlcat(urlString, instance.ip.toString().c_str(), sizeof(urlString));
+        row.add(urlString); //copied
       }
+      else if (strcmp(id, "link") == 0) row.add(groupSize(instance));
+      else if (strcmp(id, "IP") == 0) row.add(instance.ip.toString()); //copied
+      else if (strcmp(id, "type") == 0) row.add(typeName(instance.sysData.type));
+      else if (strcmp(id, "version") == 0) row.add(instance.version);
+      else if (strcmp(id, "uptime") == 0) row.add(instance.sysData.uptime);
+      else if (strcmp(id, "now") == 0) row.add(instance.sysData.now / 1000);
+      else if (strcmp(id, "timestamp") == 0) row.add(instance.sysData.timeSource);
+      else if (strcmp(id, "time") == 0) row.add(instance.sysData.tokiTime);
+      else if (strcmp(id, "ms") == 0) row.add(instance.sysData.tokiMs);
+      else if (strcmp(id, "offset") == 0) row.add(instance.clockOffset);
+      else if (strcmp(id, "jitter") == 0) row.add(instance.clockJitter);
+      else if (strncmp(id, "ins", 3) == 0 && strchr(id, '_')) row.add(instance.jsonData[strchr(id, '_') + 1]); //dash columns: ins<pid>_<id>
+      else row.add(nullptr);
     }
+  }
 
-    return nullptr;
+  static const char * typeName(byte type) {
+    return (type==0)?"WLED":(type==1)?"StarBase":(type==2)?"StarLight":(type==3)?"StarLedsLive":"StarFork";
+  }
+
+  void renewDeadline(InstanceInfo &instance) {
+    instance.deadline = millis() + announceExpiry(instances.size(), instance.interval);
+    expiries.push(instance.deadline, (uint32_t)instance.ip);
+  }
+
+  //create: if not found, add it (without name: first in the list till renamed)
+  InstanceInfo * findInstance(IPAddress ip, bool create = true) {
+    auto found = ipIndex.find((uint32_t)ip);
+    if (found != ipIndex.end()) return &instances[found->second];
+    if (!create) return nullptr;
+
+    InstanceInfo instance;
+    instance.ip = ip;
+    instance.timeStamp = millis();
+    instances.insert(instances.begin(), instance);
+    updateIndex(0, instances.size());
+    renewDeadline(instances[0]);
+    return &instances[0];
+  }
+
+  //keeps instances sorted by name and the groups up to date, returns the (moved) instance
+  InstanceInfo * renameInstance(InstanceInfo *instance, const char *name) {
+    if (strncmp(instance->name, name, sizeof(instance->name)) == 0) return instance;
+
+    removeFromGroup(*instance);
+    InstanceInfo renamed = *instance;
+    strlcpy(renamed.name, name, sizeof(renamed.name));
+    renamed.groupHash = groupHash(renamed.name);
+    addToGroup(renamed);
+
+    size_t from = instance - instances.data();
+    instances.erase(instances.begin() + from);
+    auto position = std::upper_bound(instances.begin(), instances.end(), renamed, [](const InstanceInfo &a, const InstanceInfo &b){ return strncmp(a.name, b.name, sizeof(a.name)) < 0; });
+    position = instances.insert(position, renamed);
+    size_t index = position - instances.begin();
+
+    updateIndex(from < index?from:index, (from < index?index:from) + 1); //only the rows in between shifted
+    return &instances[index];
   }
 
   private:
+    std::unordered_map<uint32_t, size_t> ipIndex; //ip -> index in instances
+    DeadlineHeap<uint32_t> expiries; //ip per deadline, outdated entries are skipped when popped
+    unsigned long nextAnnounce = 0;
+
+    //binary dash payload
+    std::unordered_map<uint16_t, JsonObject> dashVars; //tlvKey -> dash variable
+    uint32_t announces = 0;
+    uint32_t announceBytes = 0;
+    uint64_t decodeCycles = 0;
+    uint32_t decodes = 0;
+
+    struct GroupInfo {
+      uint32_t hash;
+      char name[32]; //an instance name in the group, to tell groups with the same hash apart
+      uint8_t size;
+    };
+    std::vector<GroupInfo> groups; //of the instances, few so not indexed
+
+    //the index of the instances from first till last (exclusive), after rows have been inserted, moved or removed
+    void updateIndex(size_t first, size_t last) {
+      for (size_t index = first; index < last && index < instances.size(); index++)
+        ipIndex[(uint32_t)instances[index].ip] = index;
+    }
+
+    GroupInfo * findGroup(const InstanceInfo &instance) {
+      if (!instance.groupHash) return nullptr;
+      for (GroupInfo &group: groups)
+        if (group.hash == instance.groupHash && sameGroupName(group.name, instance.name)) return &group;
+      return nullptr;
+    }
+
+    void addToGroup(const InstanceInfo &instance) {
+      if (!instance.groupHash) return;
+      GroupInfo *group = findGroup(instance);
+      if (group) {group->size++; return;}
+      GroupInfo newGroup;
+      newGroup.hash = instance.groupHash;
+      strlcpy(newGroup.name, instance.name, sizeof(newGroup.name));
+      newGroup.size = 1;
+      groups.push_back(newGroup);
+    }
+
+    void removeFromGroup(const InstanceInfo &instance) {
+      GroupInfo *group = findGroup(instance);
+      if (group && --group->size == 0) groups.erase(groups.begin() + (group - groups.data()));
+    }
+
     //sync (only WLED)
     WiFiUDP notifierUdp;
     uint16_t notifierUDPPort = 21324;
@@ -880,6 +1207,12 @@ public:
     uint16_t instanceUDPPort = 65506;
     bool udp2Connected = false;
 
+    //group messages (multicast mode)
+    WiFiUDP groupUDP;
+    bool3State multicast = false;
+    uint32_t joinedGroupHash = 0;
+    bool groupConnected = false;
+
 };
 
 extern SysModInstances *instances;
\ No newline at end of file
@@ -148,7 +148,7 @@
     if (eventType == onChange) {
       if (!init) {
         if (!var["dash"].isNull())
-          instances->changedVarsQueue.push_back(var); //tbd: check value arrays / rowNr is working
+          instances->queueChange(*this); //tbd: check value arrays / rowNr is working
       }
 
       //if var is bound by pointer, set the pointer value before calling onChange
@@ -353,6 +353,8 @@ public:
   RAM_Allocator allocator;
   JsonDocument *model = nullptr;
   JsonDocument *presets = nullptr;
+  //held by loopTask while it runs the module loops (which change the model), other tasks take it to read a module in one piece
+  SemaphoreHandle_t modelMutex = xSemaphoreCreateMutex();
 
   bool doWriteModel = false;
 
@@ -63,39 +63,22 @@ void SysModPins::setup() {
     default: return false;
   }});
 
-  ui->initCanvas(parentVar, "board", UINT16_MAX, true, [](EventArguments) { switch (eventType) {
+  Variable boardVar = ui->initCanvas(parentVar, "board", UINT16_MAX, true, [](EventArguments) { switch (eventType) {
     case onUI:
       variable.setComment("Pin viewer 🚧");
       return true;
-    case onLoop:
-      if (!web->isBusy && web->ws.getClients().length()) {
-        variable.var["interval"] = 100; //every 100 ms
-
-        size_t len = NUM_DIGITAL_PINS + 5;
-        AsyncWebSocketMessageBuffer *wsBuf= web->ws.makeBuffer(len); //global wsBuf causes crash in audio sync module!!!
-        if (wsBuf) {
-          wsBuf->lock();
-          byte* buffer = wsBuf->get();
-          // send pins to clients
-          for (size_t pin = 0; pin < NUM_DIGITAL_PINS; pin++)
-          {
-            buffer[pin+5] = random(8);// digitalRead(pin) * 255; // is only 0 or 1
-          }
-          // ppf("\n");
-          //new values
-          buffer[0] = 0; //userFun id
-
-          web->sendBuffer(wsBuf, true);
-
-          wsBuf->unlock();
-          web->ws._cleanBuffers();
-        }
-      }
-      return true;
-
     default: return false;
   }});
 
+  //binary channel 0, 10 fps to the clients showing the board
+  web->addChannel(boardVar.var, 0, NUM_DIGITAL_PINS + 5, 10, [](byte *buffer, size_t len) {
+    // send pins to clients
+    for (size_t pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    {
+      buffer[pin+5] = random(8);// digitalRead(pin) * 255; // is only 0 or 1
+    }
+  });
+
 #if CONFIG_IDF_TARGET_ESP32
   // softhack007: configuring these pins on S3/C3/S2 may cause major problems (crashes included)
   // pinMode(2, OUTPUT);  // softhack007 default LED pin on some boards, so don't play around with gpio2
@@ -239,6 +239,9 @@ void SysModSystem::setup() {
 
 void SysModSystem::loop() {
   loopCounter++;
+  portENTER_CRITICAL(&countersMux);
+  loopsSinceBoot++;
+  portEXIT_CRITICAL(&countersMux);
   now = millis() + timebase;
 }
 
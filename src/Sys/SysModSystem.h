@@ -26,6 +26,15 @@ public:
       now = millis(),
       timebase = 0;
 
+  //64 bit counters written by loopTask (loops, SysModule::cpuCycles), read by other tasks (e.g. /metrics)
+  mutable portMUX_TYPE countersMux = portMUX_INITIALIZER_UNLOCKED;
+  uint64_t loopsTotal() const {
+    portENTER_CRITICAL(&countersMux);
+    uint64_t loops = loopsSinceBoot;
+    portEXIT_CRITICAL(&countersMux);
+    return loops;
+  }
+
   SysModSystem();
   void setup() override;
   void loop() override;
@@ -64,6 +73,7 @@ public:
 
 private:
   unsigned long loopCounter = 0;
+  uint64_t loopsSinceBoot = 0; //under countersMux
 
   void addResetReasonsSelect(JsonArray select);
   void addRestartReasonsSelect(JsonArray select);
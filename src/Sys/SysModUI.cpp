@@ -68,13 +68,12 @@ void SysModUI::loop20ms() { //never more then 50 times a second!
 void SysModUI::processJson(JsonVariant json) {
   if (json.is<JsonObject>()) //should be
   {
-     //varEvent adds object elements to json which would be processed in the for loop. So we freeze the original pairs in a vector and loop on this
-    std::vector<JsonPair> pairs;
+    //varEvent adds object elements to json (responses are appended at the end), so only the original pairs are processed
+    //no copy of the pairs: removing keys is done after the loop as removing the current pair breaks the iterator
+    size_t nrOfPairs = json.size();
+    bool removeOnUI = false;
     for (JsonPair pair : json.as<JsonObject>()) { //iterate json elements
-      pairs.push_back(pair);
-    }
-
-    for (JsonPair pair : pairs) { //iterate json elements
+      if (nrOfPairs-- == 0) break;
       const char * key = pair.key().c_str();
       JsonVariant value = pair.value();
 
@@ -86,7 +85,7 @@ void SysModUI::processJson(JsonVariant json) {
       else if (pair.key() == "view" || pair.key() == "canvasData" || pair.key() == "theme") { //save the chosen view in System (see index.js)
         JsonObject var = mdl->findVar("m", "System");
         ppf("processJson %s v:%s n: %d s:%s\n", pair.key().c_str(), pair.value().as<String>().c_str(), var.isNull(), Variable(var).id());
-        var[JsonString(key)] = pair.value(); //this is needed as key can become a dangling pointer
+        var[JsonString(key, JsonString::Copied)] = pair.value(); //copy the key: it lives in the responseDoc which is cleared after sending
         // json.remove(key); //key should stay as all clients use this to perform the changeHTML action
       }
       else if (pair.key() == "onAdd" || pair.key() == "onDelete") {
@@ -129,7 +128,7 @@ void SysModUI::processJson(JsonVariant json) {
           }
         } else
           ppf("dev processJson value not array? %s %s\n", key, value.as<String>().c_str());
-        json.remove(key); //key processed we don't need the key in the response
+        removeOnUI = true; //key processed we don't need the key in the response
       } 
 
      else if (!value.isNull()) { // {"varid": {"value":value}} or {"varid": value}
@@ -190,5 +189,7 @@ void SysModUI::processJson(JsonVariant json) {
         ppf("dev processJson command not recognized k:%s v:%s\n", key, value.as<String>().c_str());
       }
     } //for json pairs
+
+    if (removeOnUI) json.remove("onUI");
   }
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "SysModules.h"
 #include "SysModPins.h"
 #include "SysModNetwork.h" //for localIP
+#include "SysModSystem.h"
 
 #include "User/UserModMDNS.h"
 // got multiple definition error here ??? see workaround below
@@ -30,6 +31,7 @@
 #include "AsyncJson.h"
 
 #include <ArduinoOTA.h>
+#include <unistd.h> //truncate
 
 //https://techtutorialsx.com/2018/08/24/esp32-web-server-serving-html-from-file-system/
 //https://randomnerdtutorials.com/esp32-async-web-server-espasyncwebserver-library/
@@ -40,8 +42,8 @@ SysModWeb::SysModWeb() :SysModule("Web") {
   DefaultHeaders::Instance().addHeader(F("Access-Control-Allow-Methods"), "*");
   DefaultHeaders::Instance().addHeader(F("Access-Control-Allow-Headers"), "*");
 
-  responseDocLoopTask = new JsonDocument; responseDocLoopTask->to<JsonObject>();
-  responseDocAsyncTCP = new JsonDocument; responseDocAsyncTCP->to<JsonObject>();
+  //constructed in setup() so this is the loopTask
+  responseDocLoopTask = getResponseDoc();
 };
 
 void SysModWeb::setup() {
@@ -109,39 +111,115 @@ void SysModWeb::setup() {
 
   ui->initText(parentVar, "WSSend", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
     case onLoop1s:
-      variable.setValueF("#: %d /s T: %d B/s B:%d B/s", sendWsCounter, sendWsTBytes, sendWsBBytes);
-      sendWsCounter = 0;
-      sendWsTBytes = 0;
-      sendWsBBytes = 0;
+      variable.setValueF("#: %d /s T: %d B/s B:%d B/s", sendWsCounter.delta(), sendWsTBytes.delta(), sendWsBBytes.delta());
     default: return false;
   }});
 
   ui->initText(parentVar, "WSRecv", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
-    case onLoop1s:
-      variable.setValueF("#: %d /s %d B/s", recvWsCounter, recvWsBytes);
-      recvWsCounter = 0;
-      recvWsBytes = 0;
-      return true;
+    case onLoop1s: {
+      uint32_t commands = recvWsCounter.delta();
+      uint32_t allocations = recvWsAllocations.delta();
+      variable.setValueF("#: %d /s %d B/s %d allocs/cmd", commands, recvWsBytes.delta(), commands?allocations / commands:0);
+      return true; }
     default: return false;
   }});
 
   ui->initText(parentVar, "UDPSend", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
     case onLoop1s:
-      variable.setValueF("#: %d /s %d B/s", sendUDPCounter, sendUDPBytes);
-      sendUDPCounter = 0;
-      sendUDPBytes = 0;
+      variable.setValueF("#: %d /s %d B/s", sendUDPCounter.delta(), sendUDPBytes.delta());
       return true;
     default: return false;
   }});
 
   ui->initText(parentVar, "UDPRecv", nullptr, 16, true, [this](EventArguments) { switch (eventType) {
     case onLoop1s:
-      variable.setValueF("#: %d /s %d B/s", recvUDPCounter, recvUDPBytes);
-      recvUDPCounter = 0;
-      recvUDPBytes = 0;
+      variable.setValueF("#: %d /s %d B/s", recvUDPCounter.delta(), recvUDPBytes.delta());
+    default: return false;
+  }});
+
+  ui->initText(parentVar, "flush", nullptr, 32, true, [this](EventArguments) { switch (eventType) {
+    case onUI:
+      variable.setComment("loopTask responses: flushes, bytes and change to flush latency");
+      return true;
+    case onLoop1s: {
+      //percentiles over the last flushes
+      uint16_t latencies[sizeof(flushLatencies) / sizeof(flushLatencies[0])];
+      memcpy(latencies, flushLatencies, sizeof(latencies));
+      std::sort(latencies, latencies + flushLatencyCount);
+      uint16_t p50 = flushLatencyCount?latencies[flushLatencyCount * 50 / 100]:0;
+      uint16_t p99 = flushLatencyCount?latencies[flushLatencyCount * 99 / 100]:0;
+      variable.setValueF("#: %d /s %d B/s p50: %d ms p99: %d ms", flushCounter, flushBytes, p50, p99);
+      flushCounter = 0;
+      flushBytes = 0;
+      return true; }
+    default: return false;
+  }});
+
+  ui->initText(parentVar, "WLEDJson", nullptr, 32, true, [this](EventArguments) { switch (eventType) {
+    case onUI:
+      variable.setComment("/json, /json/state and /json/info requests and their latency");
+      return true;
+    case onLoop1s:
+      variable.setValueF("#: %d /s avg %d µs max %d µs", wledJsonCounter, wledJsonCounter?wledJsonCycles / wledJsonCounter / ESP.getCpuFreqMHz():0, wledJsonMaxCycles / ESP.getCpuFreqMHz());
+      wledJsonCounter = 0;
+      wledJsonCycles = 0;
+      wledJsonMaxCycles = 0;
+      return true;
+    default: return false;
+  }});
+
+  ui->initText(parentVar, "WSLimit", nullptr, 32, true, [this](EventArguments) { switch (eventType) {
+    case onUI:
+      variable.setComment("Over budget commands per client");
+      return true;
+    case onLoop1s:
+      variable.setValueF("coalesced: %d /s dropped: %d /s", wsCoalesced, wsDropped);
+      wsCoalesced = 0;
+      wsDropped = 0;
+      return true;
     default: return false;
   }});
 
+  ui->initText(parentVar, "channels", nullptr, 32, true, [this](EventArguments) { switch (eventType) {
+    case onUI:
+      variable.setComment("Binary channel frames: encoded size and encode time");
+      return true;
+    case onLoop1s:
+      variable.setValueF("%d%% %d cycles/KB", channelRawBytes?channelEncodedBytes * 100 / channelRawBytes:0, channelRawBytes?(uint32_t)((uint64_t)channelEncodeCycles * 1024 / channelRawBytes):0);
+      channelRawBytes = 0;
+      channelEncodedBytes = 0;
+      channelEncodeCycles = 0;
+      return true;
+    default: return false;
+  }});
+
+  for (Histogram *histogram: latencies) {
+    ui->initText(parentVar, histogram->name, nullptr, 48, true, [histogram](EventArguments) { switch (eventType) {
+      case onUI:
+        variable.setComment("Latency percentiles since boot");
+        return true;
+      case onLoop1s:
+        variable.setValueF("p50: %d p95: %d p99: %d µs #: %d", histogram->percentile(50), histogram->percentile(95), histogram->percentile(99), histogram->count.load());
+        return true;
+      default: return false;
+    }});
+  }
+
+  #ifdef STARBASE_DEVMODE
+
+  ui->initButton(parentVar, "connectStorm", false, [this](EventArguments) { switch (eventType) {
+    case onUI:
+      variable.setComment("Serialize module definitions for 1..20 connecting clients, uncached vs cached");
+      return true;
+    case onChange:
+      doConnectStorm = true; //in loopTask
+      return true;
+    default: return false;
+  }});
+
+  ui->initText(parentVar, "connectStormResult", nullptr, 64, true);
+
+  #endif //STARBASE_DEVMODE
 }
 
 void SysModWeb::loop20ms() {
@@ -162,10 +240,46 @@ void SysModWeb::loop20ms() {
       Variable(childVar).triggerEvent(onSetValue); //set the value (WIP)
   }
 
+  processPendingCommands();
+
+  produceChannels();
+
+  if (responseDirtyMillis)
+    flushResponses();
+
+  flushTaskResponses();
+
+  #ifdef STARBASE_DEVMODE
+    if (doConnectStorm) {
+      doConnectStorm = false;
+      connectStormBenchmark();
+    }
+  #endif
+}
+
+void SysModWeb::loop10s() {
+  //module blobs are for connect storms, release the memory if no clients connected for a while
+  if (moduleBlobs.size() && millis() - moduleBlobsMillis > 10000) {
+    xSemaphoreTake(wsMutex, portMAX_DELAY);
+    clearModuleBlobs();
+    xSemaphoreGive(wsMutex);
+  }
 }
 
-void SysModWeb::loop1s() {
-  sendResponseObject(); //this sends all the loopTask responses once per second !!!
+void SysModWeb::flushResponses(bool immediate) {
+  //over budget: stay dirty and try again next tick
+  if (!immediate && (flushCounter >= flushMaxPerSecond || flushBytes >= flushMaxBytesPerSecond)) return;
+
+  unsigned long dirtyMillis = responseDirtyMillis;
+  size_t len = sendResponseObject();
+  responseDirtyMillis = 0;
+  if (len) {
+    flushCounter++;
+    flushBytes += len;
+    flushLatencies[flushLatencyIndex] = millis() - dirtyMillis;
+    flushLatencyIndex = (flushLatencyIndex + 1) % (sizeof(flushLatencies) / sizeof(flushLatencies[0]));
+    if (flushLatencyCount < sizeof(flushLatencies) / sizeof(flushLatencies[0])) flushLatencyCount++;
+  }
 }
 
 void SysModWeb::reboot() {
@@ -173,7 +287,15 @@ void SysModWeb::reboot() {
   ws.closeAll(1012);
 }
 
+//FNV-1a of embedded content: builds of the same version (hour) with pages of the same length get another eTag
+static void contentETag(char *eTag, size_t size, const uint8_t *content, size_t len) {
+  uint32_t hash = 2166136261;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ content[i]) * 16777619;
+  print->fFormat(eTag, size, "\"%08x-%x\"", (unsigned)hash, (unsigned)len);
+}
+
 void SysModWeb::connectedChanged() {
+  wledJsonDirty = true; //ip in info
   if (mdls->isConnected) {
     #ifdef STARBASE_USE_Psychic
 
@@ -202,12 +324,20 @@ void SysModWeb::connectedChanged() {
       WWWData::registerRoutes(
           [this](const String &uri, const String &contentType, const uint8_t *content, size_t len)
           {
-              server.on(uri.c_str(), HTTP_GET, [this, content, len, contentType](WebRequest *request) {
+              //embedded content only changes with a new build, hashed once when the route is registered
+              char eTagBuf[24];
+              contentETag(eTagBuf, sizeof(eTagBuf), content, len);
+              String eTag = eTagBuf;
+              bool immutable = uri.startsWith("/_app/immutable/"); //svelte: hashed file names
+
+              server.on(uri.c_str(), HTTP_GET, [this, content, len, contentType, eTag, immutable](WebRequest *request) {
+                httpRequests++;
+                if (handleIfNoneMatchCacheHeader(request, eTag.c_str())) return;
+
                 WebResponse *response;
                 response = request->beginResponse_P(200, contentType.c_str(), content, len);
                 response->addHeader("Content-Encoding","gzip");
-                // response.addHeader("Cache-Control", "public, immutable, max-age=31536000"); //from svelte
-                // setStaticContentCacheHeaders(response);
+                setStaticContentCacheHeaders(response, eTag.c_str(), immutable);
                 request->send(response);
               });
 
@@ -222,12 +352,23 @@ void SysModWeb::connectedChanged() {
     #endif
 
     //serve json calls
-    server.on("/json", HTTP_GET, [this](WebRequest *request) {serveJson(request);});
+    server.on("/json", HTTP_GET, [this](WebRequest *request) {
+      httpRequests++;
+      measureLatency(request, latencyServeJson);
+      serveJson(request); //also called by jsonHandler
+    });
 
     server.addHandler(new AsyncCallbackJsonWebHandler("/json", [this](WebRequest *request, JsonVariant &json){jsonHandler(request, json);}));
 
+    server.on("/api", HTTP_GET | HTTP_PUT, [this](WebRequest *request) {serveApi(request);}, nullptr, [this](WebRequest *request, byte *data, size_t len, size_t index, size_t total) {serveApiBody(request, data, len, index, total);});
+
+    server.on("/events", HTTP_GET, [this](WebRequest *request) {serveEvents(request);});
+
+    server.on("/metrics", HTTP_GET, [this](WebRequest *request) {serveMetrics(request);});
+
     server.on("/update", HTTP_POST, [](WebRequest *) {}, [this](WebRequest *request, const String& fileName, size_t index, byte *data, size_t len, bool final) {serveUpdate(request, fileName, index, data, len, final);});
     server.on("/file", HTTP_GET, [this](WebRequest *request) {serveFiles(request);});
+    server.on("/file", HTTP_PUT, [this](WebRequest *request) {serveFileWritten(request);}, nullptr, [this](WebRequest *request, byte *data, size_t len, size_t index, size_t total) {serveFileWrite(request, data, len, index, total);});
     server.on("/upload", HTTP_POST, [](WebRequest *) {}, [this](WebRequest *request, const String& fileName, size_t index, byte *data, size_t len, bool final) {serveUpload(request, fileName, index, data, len, final);});
 
     server.onNotFound([this](AsyncWebServerRequest *request) {
@@ -254,7 +395,17 @@ void SysModWeb::wsEvent(WebSocket * ws, WebClient * client, AwsEventType type, v
   if (type == WS_EVT_CONNECT) {
     printClient("WS client connected", client);
 
+    xSemaphoreTake(wsMutex, portMAX_DELAY);
+    WebClientInfo clientInfo;
+    clientInfo.id = client->id();
+    clientInfo.commandTokens = wsCommandsPerSecond;
+    clientInfo.byteTokens = wsBytesPerSecond;
+    clientInfo.tokensMillis = millis();
+    clientInfos.push_back(clientInfo);
+    xSemaphoreGive(wsMutex);
+
     //send system constants
+    beginResponse(); //only to this client
     getResponseObject()["sysInfo"]["board"] = CONFIG_IDF_TARGET;
     getResponseObject()["sysInfo"]["nrOfPins"] = NUM_DIGITAL_PINS;
     getResponseObject()["sysInfo"]["pinTypes"].to<JsonArray>();
@@ -265,29 +416,21 @@ void SysModWeb::wsEvent(WebSocket * ws, WebClient * client, AwsEventType type, v
 
     sendResponseObject(client);
 
-    JsonArray model = mdl->model->as<JsonArray>();
-
-    //inspired by https://github.com/bblanchon/ArduinoJson/issues/1280
-    //store arrayindex and sort order in vector
-    std::vector<ArrayIndexSortValue> aisvs;
-    size_t index = 0;
-    for (JsonObject moduleVar: model) {
-      ArrayIndexSortValue aisv;
-      aisv.index = index++;
-      aisv.value = Variable(moduleVar).order();
-      aisvs.push_back(aisv);
-    }
-    //sort the vector by the order
-    std::sort(aisvs.begin(), aisvs.end(), [](const ArrayIndexSortValue &a, const ArrayIndexSortValue &b) {return a.value < b.value;});
-
-    //send model per module to stay under websocket size limit of 8192
-    for (const ArrayIndexSortValue &aisv : aisvs) {
-      sendDataWs(model[aisv.index], client); //send definition to client
-    }
+    sendModules(client);
 
     clientsChanged = true;
   } else if (type == WS_EVT_DISCONNECT) {
     printClient("WS Client disconnected", client);
+
+    xSemaphoreTake(wsMutex, portMAX_DELAY);
+    for (auto it = clientInfos.begin(); it != clientInfos.end(); ++it) {
+      if (it->id == client->id()) {
+        clientInfos.erase(it);
+        break;
+      }
+    }
+    xSemaphoreGive(wsMutex);
+
     clientsChanged = true;
   } else if (type == WS_EVT_DATA) {
     AwsFrameInfo * info = (AwsFrameInfo*)arg;
@@ -307,17 +450,35 @@ void SysModWeb::wsEvent(WebSocket * ws, WebClient * client, AwsEventType type, v
           ppf("pong\n");
           client->text("pong");
         } else {
-          JsonDocument *responseDoc = getResponseDoc(); //we need the doc for deserializeJson
+          int64_t startUs = esp_timer_get_time();
+          TaskResponseDoc *taskResponseDoc = beginResponse(); //not flushed by loopTask while processing the command
+          JsonDocument *responseDoc = taskResponseDoc->doc; //we need the doc for deserializeJson
+          uint32_t allocations = taskResponseDoc->allocator.allocations;
+
+          //ArduinoJson 7 has no zero-copy mode: keys and strings are copied into the responseDoc (see Web.WSRecv allocs)
+          DeserializationError error = deserializeJson(*responseDoc, (const char *)data, len); //data to responseDoc
           JsonObject responseObject = getResponseObject();
 
-          DeserializationError error = deserializeJson(*responseDoc, data, len); //data to responseDoc
+          if (!error && responseObject["subscribe"].is<JsonArray>()) {
+            subscribe(client, responseObject["subscribe"]);
+            responseObject.remove("subscribe");
+          }
+          if (!error && responseObject["channels"].is<JsonArray>()) {
+            enableChannels(client, responseObject["channels"]);
+            responseObject.remove("channels");
+          }
 
           if (error || responseObject.isNull()) {
             ppf("wsEvent deserializeJson failed with code %s\n", error.c_str());
             client->text("{\"success\":true}"); // we have to send something back otherwise WS connection closes
+          } else if (!responseObject.size()) { //only subscribe and / or channels
+            client->text("{\"success\":true}");
+          } else if (floodControl(client, responseObject, len)) {
+            getResponseDoc()->to<JsonObject>(); //not processed now
           } else {
             bool isOnUI = !responseObject["onUI"].isNull();
             ui->processJson(responseObject); //adds to responseDoc / responseObject
+            recvWsAllocations += taskResponseDoc->allocator.allocations - allocations; //before sending releases the slot
 
             if (responseObject.size()) {
               sendResponseObject(isOnUI?client:nullptr); //onUI only send to requesting client async response
@@ -328,6 +489,12 @@ void SysModWeb::wsEvent(WebSocket * ws, WebClient * client, AwsEventType type, v
               client->text("{\"success\":true}"); // we have to send something back otherwise WS connection closes
             }
           }
+          if (taskResponseDoc->replying) { //not sent (error, flood control, nothing to respond): drop the command
+            responseDoc->to<JsonObject>();
+            taskResponseDoc->dirty = false;
+            endResponse(taskResponseDoc);
+          }
+          latencyWsCommand.add(esp_timer_get_time() - startUs);
         }
       }
     } else {
@@ -444,7 +611,8 @@ void SysModWeb::sendDataWs(std::function<void(AsyncWebSocketMessageBuffer *)> fi
   xSemaphoreGive(wsMutex);
 }
 
-void SysModWeb::sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, WebClient * client, bool lossless) {
+bool SysModWeb::sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, WebClient * client, bool lossless) {
+  bool sent = true;
   for (auto &loopClient:ws.getClients()) {
     if (!client || client == loopClient) {
       if (loopClient->status() == WS_CONNECTED && !loopClient->queueIsFull()) { //WS_MAX_QUEUED_MESSAGES / ws.count() / 2)) { //binary is lossy
@@ -456,9 +624,13 @@ void SysModWeb::sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, W
           else 
             sendWsTBytes+=wsBuf->length();
         }
-        else if (!lossless) ppf("sendBuffer not successful l:%d b:%d q:%d", wsBuf->length(), isBinary, loopClient->queueLen());
+        else {
+          sent = false;
+          if (!lossless) ppf("sendBuffer not successful l:%d b:%d q:%d", wsBuf->length(), isBinary, loopClient->queueLen());
+        }
       }
       else {
+        sent = false;
         printClient("sendDataWs client full or not connected", loopClient);
         // ppf("sendDataWs client full or not connected\n");
         ws.cleanupClients(); //only if above threshold
@@ -466,43 +638,54 @@ void SysModWeb::sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, W
       }
     }
   }
+  return sent;
 }
 
 //add an url to the webserver to listen to
 void SysModWeb::serveIndex(WebRequest *request) {
+  httpRequests++;
 
   ppf("Webserver: server.on serveIndex csdata %d-%d (%s)", PAGE_index, PAGE_index_L, request->url().c_str());
 
   if (captivePortal(request)) return;
 
-  // if (handleIfNoneMatchCacheHeader(request)) return;
+  static char eTag[24] = ""; //embedded page only changes with a new build: hashed once
+  if (!*eTag) contentETag(eTag, sizeof(eTag), PAGE_index, PAGE_index_L);
+
+  if (handleIfNoneMatchCacheHeader(request, eTag)) {ppf(" 304\n"); return;}
 
   WebResponse *response;
   response = request->beginResponse_P(200, "text/html", PAGE_index, PAGE_index_L);
   response->addHeader("Content-Encoding","gzip");
-  // setStaticContentCacheHeaders(response);
+  setStaticContentCacheHeaders(response, eTag);
   request->send(response);
 
   ppf("!\n");
 }
 void SysModWeb::serveNewUI(WebRequest *request) {
+  httpRequests++;
 
   ppf("Webserver: server.on serveNewUI csdata %d-%d (%s)", PAGE_newui, PAGE_newui_L, request->url().c_str());
 
   if (captivePortal(request)) return;
 
-  // if (handleIfNoneMatchCacheHeader(request)) return;
+  static char eTag[24] = ""; //embedded page only changes with a new build: hashed once
+  if (!*eTag) contentETag(eTag, sizeof(eTag), PAGE_newui, PAGE_newui_L);
+
+  if (handleIfNoneMatchCacheHeader(request, eTag)) {ppf(" 304\n"); return;}
 
   WebResponse *response;
   response = request->beginResponse_P(200, "text/html", PAGE_newui, PAGE_newui_L);
   response->addHeader("Content-Encoding","gzip");
-  // setStaticContentCacheHeaders(response);
+  setStaticContentCacheHeaders(response, eTag);
   request->send(response);
 
   ppf("!\n");
 }
 
 void SysModWeb::serveUpload(WebRequest *request, const String& fileName, size_t index, byte *data, size_t len, bool final) {
+  httpRecvBytes += len;
+  if (final) httpRequests++;
 
   // curl -F 'data=@fixture1.json' 192.168.1.213/upload
   // ppf("serveUpload i:%d l:%d f:%d\n", index, len, final);
@@ -563,6 +746,8 @@ void SysModWeb::serveUpload(WebRequest *request, const String& fileName, size_t
 }
 
 void SysModWeb::serveUpdate(WebRequest *request, const String& fileName, size_t index, byte *data, size_t len, bool final) {
+  httpRecvBytes += len;
+  if (final) httpRequests++;
 
   // curl -F 'data=@fixture1.json' 192.168.1.213/upload
   // ppf("serveUpdate r:%s f:%s i:%d l:%d f:%d\n", index, len, final);
@@ -608,27 +793,228 @@ void SysModWeb::serveUpdate(WebRequest *request, const String& fileName, size_t
 }
 
 void SysModWeb::serveFiles(WebRequest *request) {
+  httpRequests++;
+  measureLatency(request, latencyServeFiles);
 
   const char * urlString = request->url().c_str();
   const char * path = urlString + strnlen("/file", 6); //remove the uri from the path (skip their positions)
   ppf("fileServer request %s\n", path);
   if(LittleFS.exists(path)) {
+    //eTag from modification time and size
+    char eTag[24];
+    File file = LittleFS.open(path);
+    size_t fileSize = file.size();
+    print->fFormat(eTag, sizeof(eTag), "\"%x-%x\"", (unsigned)file.getLastWrite(), fileSize);
+    file.close();
+
+    if (handleIfNoneMatchCacheHeader(request, eTag)) return;
+
+    isBusy = true;
+    WebResponse *response;
+
+    if (request->hasHeader("Range")) {
+      //only single ranges: bytes=start-end, bytes=start- or bytes=-suffixLength
+      const char * range = request->getHeader("Range")->value().c_str();
+      size_t start = 0, end = fileSize - 1;
+      bool valid = strncmp(range, "bytes=", 6) == 0 && fileSize > 0;
+      if (valid) {
+        range += 6;
+        char *dash;
+        if (*range == '-') { //suffix
+          size_t suffixLength = strtoul(range + 1, nullptr, 10);
+          valid = suffixLength > 0;
+          if (suffixLength < fileSize) start = fileSize - suffixLength;
+        } else {
+          start = strtoul(range, &dash, 10);
+          valid = *dash == '-' && start < fileSize;
+          if (valid && isdigit(dash[1])) end = min(strtoul(dash + 1, nullptr, 10), (unsigned long)fileSize - 1);
+          valid = valid && start <= end;
+        }
+      }
+
+      if (!valid) {
+        char contentRange[32];
+        print->fFormat(contentRange, sizeof(contentRange), "bytes */%d", fileSize);
+        response = request->beginResponse(416); //range not satisfiable
+        response->addHeader("Content-Range", contentRange);
+        request->send(response);
+        isBusy = false;
+        return;
+      }
+
+      //read the range from the file as the TCP send window allows
+      std::shared_ptr<File> rangeFile = std::make_shared<File>(LittleFS.open(path)); //closed when the response is done
+      size_t length = end - start + 1;
+      response = request->beginResponse(contentType(path), length, [rangeFile, start, length](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        if (index >= length) return 0;
+        rangeFile->seek(start + index);
+        return rangeFile->read(buffer, min(maxLen, length - index));
+      });
+      response->setCode(206); //partial content
+
+      char contentRange[48];
+      print->fFormat(contentRange, sizeof(contentRange), "bytes %d-%d/%d", start, end, fileSize);
+      response->addHeader("Content-Range", contentRange);
+    }
+    else
+      response = request->beginResponse(LittleFS, path, contentType(path));
+
+    response->addHeader("Accept-Ranges", "bytes");
+    setStaticContentCacheHeaders(response, eTag);
+    request->send(response);
+    isBusy = false;
+  }
+}
+
+void SysModWeb::serveFileWrite(WebRequest *request, byte *data, size_t len, size_t index, size_t total) {
+  httpRecvBytes += len;
+  const char * path = request->url().c_str() + strnlen("/file", 6);
+
+  if (!index) {
     isBusy = true;
-    request->send(LittleFS, path, "text/plain");//"application/json");
+    size_t offset = request->hasParam("offset")?request->getParam("offset")->value().toInt():0;
+    ppf("fileWrite %s offset:%d total:%d\n", path, offset, total);
+
+    //no offset: the whole file (truncated). Offset: r+ keeps what is before the written part, the rest is truncated when done
+    request->_tempFile = (offset && LittleFS.exists(path))?LittleFS.open(path, "r+"):files->open(path, FILE_WRITE);
+    if (!request->_tempFile || offset > request->_tempFile.size()) { //no gaps
+      request->_tempObject = strdup(request->_tempFile?"offset beyond end of file":"file open failed"); //freed by the request
+      request->_tempFile.close();
+      return;
+    }
+    request->_tempFile.seek(offset);
+  }
+
+  if (request->_tempFile) request->_tempFile.write(data, len);
+
+  if (index + len == total && request->_tempFile) {
+    size_t end = request->_tempFile.position();
+    bool longer = request->_tempFile.size() > end; //old tail after the written part
+    request->_tempFile.close();
+    if (longer) {
+      char vfsPath[64];
+      print->fFormat(vfsPath, sizeof(vfsPath), "/littlefs%s", path); //File has no truncate, the vfs has
+      if (truncate(vfsPath, end) != 0)
+        ppf("dev fileWrite truncate %s at %d failed\n", path, end);
+    }
+    files->filesChanged = true;
     isBusy = false;
   }
 }
 
+void SysModWeb::serveFileWritten(WebRequest *request) {
+  httpRequests++;
+  isBusy = false;
+  if (request->_tempObject) { //set by serveFileWrite
+    request->send(400, "text/plain", (const char *)request->_tempObject);
+    return;
+  }
+  const char * path = request->url().c_str() + strnlen("/file", 6);
+  File file = LittleFS.open(path);
+  char result[32];
+  print->fFormat(result, sizeof(result), "{\"size\":%d}", file?file.size():0);
+  file.close();
+  request->send(200, "application/json", result);
+}
+
+const char * SysModWeb::contentType(const char * path) {
+  const char * ext = strrchr(path, '.');
+  if (!ext) return "text/plain";
+  if (strcmp(ext, ".json") == 0) return "application/json";
+  if (strcmp(ext, ".htm") == 0 || strcmp(ext, ".html") == 0) return "text/html";
+  if (strcmp(ext, ".js") == 0) return "application/javascript";
+  if (strcmp(ext, ".css") == 0) return "text/css";
+  if (strcmp(ext, ".png") == 0) return "image/png";
+  if (strcmp(ext, ".jpg") == 0) return "image/jpeg";
+  if (strcmp(ext, ".ico") == 0) return "image/x-icon";
+  if (strcmp(ext, ".svg") == 0) return "image/svg+xml";
+  if (strcmp(ext, ".gz") == 0) return "application/gzip";
+  if (strcmp(ext, ".bin") == 0) return "application/octet-stream";
+  return "text/plain"; //also .sc and .txt
+}
+
+void SysModWeb::serveApi(WebRequest *request) {
+  httpRequests++;
+  measureLatency(request, latencyServeApi);
+  //url: /api/<pid>/<id>[,<id>...][/<rowNr>]
+  char path[64] = "";
+  if (request->url().length() > 5) strlcpy(path, request->url().c_str() + 5, sizeof(path));
+  char * rest = nullptr;
+  const char * pid = strtok_r(path, "/", &rest);
+  char * ids = strtok_r(nullptr, "/", &rest);
+  const char * rowStr = strtok_r(nullptr, "/", &rest);
+  uint8_t rowNr = rowStr?atoi(rowStr):UINT8_MAX;
+
+  if (!pid || !ids) {
+    request->send(400, "text/plain", "use /api/<pid>/<id>[,<id>...][/<rowNr>]");
+    return;
+  }
+
+  JsonDocument doc;
+
+  if (request->method() == HTTP_PUT) {
+    if (!request->_tempObject || strchr(ids, ',')) { //set by serveApiBody
+      request->send(400, "text/plain", "one id and a json value expected");
+      return;
+    }
+    JsonDocument value;
+    if (deserializeJson(value, (const char *)request->_tempObject)) {
+      request->send(400, "text/plain", "invalid json");
+      return;
+    }
+    JsonObject var = mdl->findVar(pid, ids);
+    if (var.isNull()) {
+      request->send(404, "text/plain", "variable not found");
+      return;
+    }
+    ppf("serveApi %s.%s = %s\n", pid, ids, (const char *)request->_tempObject);
+    Variable(var).setValueJV(value.as<JsonVariant>(), rowNr);
+    doc.set(Variable(var).getValue(rowNr));
+    sendResponseObject(); //also to the ws clients
+  }
+  else {
+    bool batch = strchr(ids, ',') != nullptr;
+    char * restIds = nullptr;
+    for (const char * id = strtok_r(ids, ",", &restIds); id; id = strtok_r(nullptr, ",", &restIds)) {
+      JsonObject var = mdl->findVar(pid, id);
+      if (var.isNull() && !batch) {
+        request->send(404, "text/plain", "variable not found");
+        return;
+      }
+      if (batch)
+        doc[id] = var.isNull()?JsonVariant():Variable(var).getValue(rowNr); //null if not found
+      else
+        doc.set(Variable(var).getValue(rowNr));
+    }
+  }
+
+  String result;
+  serializeJson(doc, result);
+  request->send(200, "application/json", result);
+}
+
+void SysModWeb::serveApiBody(WebRequest *request, byte *data, size_t len, size_t index, size_t total) {
+  httpRecvBytes += len;
+  if (total > 1024) return; //not a single value
+  if (!index) request->_tempObject = calloc(total + 1, 1); //freed by the request
+  if (request->_tempObject) memcpy((char *)request->_tempObject + index, data, len);
+}
+
 void SysModWeb::jsonHandler(WebRequest *request, JsonVariant json) {
+  httpRequests++;
+  measureLatency(request, latencyJsonHandler);
+  httpRecvBytes += request->contentLength();
 
   print->printJson("jsonHandler", json);
 
+  beginResponse(); //the response is send to the request
   JsonObject responseObject = getResponseObject();
 
   ui->processJson(json);
 
   //WLED compatibility
   if (json["v"]) { //WLED compatibility: verbose response
+    wledJsonDirty = true; //responses of processJson not send yet
     serveJson (request); //includes values just updated by processJson e.g. Bri
   }
   else {
@@ -683,19 +1069,142 @@ bool SysModWeb::captivePortal(WebRequest *request)
   return false;
 }
 
+bool SysModWeb::handleIfNoneMatchCacheHeader(WebRequest *request, const char * eTag) {
+  if (!request->hasHeader("If-None-Match")) return false;
+  if (request->getHeader("If-None-Match")->value().indexOf(eTag) < 0) return false; //indexOf: can be a list of eTags
+
+  WebResponse *response = request->beginResponse(304); //not modified
+  setStaticContentCacheHeaders(response, eTag);
+  request->send(response);
+  return true;
+}
+
+void SysModWeb::setStaticContentCacheHeaders(WebResponse *response, const char * eTag, bool immutable) {
+  //no-cache: the browser keeps it but revalidates with If-None-Match each time
+  response->addHeader("Cache-Control", immutable?"public, immutable, max-age=31536000":"no-cache");
+  response->addHeader("ETag", eTag);
+}
+
 JsonDocument * SysModWeb::getResponseDoc() {
-  // ppf("response wsevent core %d %s\n", xPortGetCoreID(), pcTaskGetTaskName(nullptr));
+  return getTaskResponseDoc()->doc;
+}
+
+SysModWeb::TaskResponseDoc * SysModWeb::getTaskResponseDoc() {
+  // ppf("response wsevent core %d %s\n", xPortGetCoreID(), pcTaskGetTaskName(nullptr)); //no ppf here: ppf can call getResponseDoc
+
+  TaskHandle_t task = xTaskGetCurrentTaskHandle(); //cheap, no name lookup
+  for (TaskResponseDoc &responseDoc: responseDocs)
+    if (responseDoc.task == task) return &responseDoc;
+
+  //first call from this task since its slot was released: claim a free slot
+  //all taken: wait until flushTaskResponses releases one (not written for a tick), no lock is held meanwhile
+  TaskResponseDoc *claimed = nullptr;
+  while (!claimed) {
+    portENTER_CRITICAL(&responseDocsMux);
+    for (TaskResponseDoc &responseDoc: responseDocs) {
+      if (!responseDoc.claimed) {
+        responseDoc.claimed = true;
+        responseDoc.quiet = false;
+        claimed = &responseDoc;
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&responseDocsMux);
+    if (!claimed) vTaskDelay(1);
+  }
+
+  //create the docs outside the critical section (kept when the slot is released)
+  if (!claimed->doc) {
+    claimed->doc = new JsonDocument(&claimed->allocator);
+    claimed->doc->to<JsonObject>();
+  }
+  if (!claimed->flushing) {
+    claimed->flushing = new JsonDocument(&claimed->allocator);
+    claimed->flushing->to<JsonObject>();
+  }
+  claimed->task = task; //last: a slot found by task always has a doc
+  return claimed;
+}
+
+SysModWeb::TaskResponseDoc * SysModWeb::beginResponse() {
+  TaskResponseDoc *responseDoc = getTaskResponseDoc();
+  portENTER_CRITICAL(&responseDocsMux);
+  responseDoc->replying = true;
+  responseDoc->keep = true; //async_tcp: not waiting for a slot while it holds wsMutex
+  portEXIT_CRITICAL(&responseDocsMux);
+  return responseDoc;
+}
+
+void SysModWeb::endResponse(TaskResponseDoc *responseDoc) {
+  portENTER_CRITICAL(&responseDocsMux);
+  responseDoc->replying = false;
+  portEXIT_CRITICAL(&responseDocsMux);
+}
+
+void SysModWeb::flushTaskResponses() {
+  //over budget: next tick
+  if (flushCounter >= flushMaxPerSecond || flushBytes >= flushMaxBytesPerSecond) return;
+
+  for (TaskResponseDoc &responseDoc: responseDocs) {
+    if (!responseDoc.flushing || responseDoc.doc == responseDocLoopTask) continue; //loopTask: flushResponses
+
+    //swapped out last tick: writes which were in progress then are done
+    JsonObject responseObject = responseDoc.flushing->as<JsonObject>();
+    if (responseObject.size()) {
+      size_t len = sendResponseObject(responseObject);
+      responseDoc.flushing->to<JsonObject>(); //recreate!
+      if (len) {
+        flushCounter++;
+        flushBytes += len;
+      }
+    }
 
-  // return responseDocLoopTask;
-  return strncmp(pcTaskGetTaskName(nullptr), "loopTask", 8) == 0?responseDocLoopTask:responseDocAsyncTCP;
+    portENTER_CRITICAL(&responseDocsMux);
+    if (responseDoc.claimed && responseDoc.task && !responseDoc.replying) {
+      if (responseDoc.dirty) {
+        std::swap(responseDoc.doc, responseDoc.flushing);
+        responseDoc.dirty = false;
+        responseDoc.quiet = false;
+      }
+      else if (responseDoc.quiet && !responseDoc.keep) { //not written for a tick: release the slot
+        responseDoc.task = nullptr;
+        responseDoc.claimed = false;
+      }
+      else
+        responseDoc.quiet = true;
+    }
+    portEXIT_CRITICAL(&responseDocsMux);
+  }
 }
 
 JsonObject SysModWeb::getResponseObject() {
-  return getResponseDoc()->as<JsonObject>();
+  TaskResponseDoc *taskResponseDoc = getTaskResponseDoc();
+  taskResponseDoc->dirty = true; //other tasks: flushed by flushTaskResponses if not replying
+  JsonDocument *responseDoc = taskResponseDoc->doc;
+  //loopTask responses are send by flushResponses, remember since when they are waiting
+  if (responseDoc == responseDocLoopTask && !responseDirtyMillis)
+    responseDirtyMillis = millis();
+  return responseDoc->as<JsonObject>();
 }
 
-void SysModWeb::sendResponseObject(WebClient * client) {
-  JsonObject responseObject = getResponseObject();
+size_t SysModWeb::sendResponseObject(WebClient * client) {
+  TaskResponseDoc *taskResponseDoc = getTaskResponseDoc();
+  portENTER_CRITICAL(&responseDocsMux);
+  taskResponseDoc->replying = true; //not swapped out by flushTaskResponses while sending
+  portEXIT_CRITICAL(&responseDocsMux);
+  JsonObject responseObject = taskResponseDoc->doc->as<JsonObject>(); //not getResponseObject as it marks responses dirty
+  size_t len = 0;
+  if (responseObject.size()) {
+    len = sendResponseObject(responseObject, client);
+    taskResponseDoc->doc->to<JsonObject>(); //recreate!
+  }
+  taskResponseDoc->dirty = false;
+  endResponse(taskResponseDoc); //sent: flushTaskResponses can flush what this task writes next
+  return len;
+}
+
+size_t SysModWeb::sendResponseObject(JsonObject responseObject, WebClient * client) {
+  size_t len = 0;
   if (responseObject.size()) {
     // if (strncmp(pcTaskGetTaskName(nullptr), "loopTask", 8) != 0) {
     //   ppf("send ");
@@ -716,27 +1225,594 @@ void SysModWeb::sendResponseObject(WebClient * client) {
     //   ppf("\n");
     // }
 
-    size_t len = measureJson(responseObject);
-    AsyncWebSocketMessageBuffer * wsBuf = ws.makeBuffer(len); //assert failed: block_trim_free heap_tlsf.c:371 (block_is_free(block) && "block must be free"), AsyncWebSocket::makeBuffer(unsigned int)
-    if (wsBuf) {
-      wsBuf->lock();
+    if (sseSubscribers) publishEvents(responseObject);
+
+    xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+    //variables with children can be added or removed: subscribed modules have other pids
+    if (moduleBlobsChanged(responseObject))
+      for (WebClientInfo &clientInfo: clientInfos)
+        if (clientInfo.subscriptionHash) resolveSubscriptions(clientInfo);
+
+    //the WLED state and info depend on these
+    if (!responseObject["Fixture.brightness"].isNull() || !responseObject["Fixture.on"].isNull() || !responseObject["System.name"].isNull())
+      wledJsonDirty = true;
+
+    bool subscriptions = false;
+    for (const WebClientInfo &clientInfo: clientInfos)
+      if (clientInfo.subscriptionHash) subscriptions = true;
+
+    //serialize once per different subscription and send to all clients with that subscription
+    std::vector<const WebClientInfo *> subscriptionsSent; //nullptr: not subscribed
+    for (auto &loopClient:ws.getClients()) {
+      if (client && client != loopClient) continue;
+      const WebClientInfo *clientInfo = (subscriptions && !client)?findClientInfo(loopClient->id()):nullptr; //a reply to a client is not filtered
+      uint32_t hash = clientInfo?clientInfo->subscriptionHash:0;
+      if (!hash) clientInfo = nullptr;
+      bool sent = false;
+      for (const WebClientInfo *sentInfo: subscriptionsSent)
+        if (sentInfo == clientInfo || (sentInfo && clientInfo && sentInfo->subscriptionHash == hash && sameSubscriptions(sentInfo->subscriptions, clientInfo->subscriptions))) sent = true;
+      if (sent) continue;
+      subscriptionsSent.push_back(clientInfo);
+
+      size_t subscribedLen = hash?serializeSubscribed(responseObject, clientInfo, nullptr):measureJson(responseObject);
+      if (subscribedLen <= 2) continue; //{}: nothing subscribed
+
+      AsyncWebSocketMessageBuffer * wsBuf = ws.makeBuffer(subscribedLen); //assert failed: block_trim_free heap_tlsf.c:371 (block_is_free(block) && "block must be free"), AsyncWebSocket::makeBuffer(unsigned int)
+      if (wsBuf) {
+        wsBuf->lock();
+
+        if (hash)
+          serializeSubscribed(responseObject, clientInfo, wsBuf->get());
+        else
+          serializeJson(responseObject, wsBuf->get(), subscribedLen);
+
+        if (client)
+          sendBuffer(wsBuf, false, client); //text
+        else {
+          for (auto &hashClient:ws.getClients()) {
+            const WebClientInfo *hashClientInfo = subscriptions?findClientInfo(hashClient->id()):nullptr;
+            if ((hashClientInfo?hashClientInfo->subscriptionHash:0) == hash && (!hash || sameSubscriptions(hashClientInfo->subscriptions, clientInfo->subscriptions)))
+              sendBuffer(wsBuf, false, hashClient); //text
+          }
+        }
 
-      serializeJson(responseObject, wsBuf->get(), len);
+        wsBuf->unlock();
+        ws._cleanBuffers();
+        len += subscribedLen;
+      }
+      else {
+        ppf("sendDataWs WS buffer allocation failed\n");
+        ws.closeAll(1013); //code 1013 = temporary overload, try again later
+        ws.cleanupClients(0); //disconnect ALL clients to release memory
+        ws._cleanBuffers();
+        break;
+      }
+    }
 
-      sendBuffer(wsBuf, false, client); //text
+    xSemaphoreGive(wsMutex);
+  }
+  return len;
+}
 
-      wsBuf->unlock();
-      ws._cleanBuffers();
+void SysModWeb::subscribe(WebClient * client, JsonArray subscriptions) {
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+  WebClientInfo *clientInfo = findClientInfo(client->id());
+  if (clientInfo) {
+    clientInfo->subscriptions.clear();
+    clientInfo->subscriptionHash = 0;
+
+    for (JsonVariant subscription: subscriptions) {
+      const char * name = subscription.as<const char *>();
+      if (!name) continue;
+
+      //FNV-1a of all subscriptions
+      if (!clientInfo->subscriptionHash) clientInfo->subscriptionHash = 2166136261;
+      for (const char *c = name; *c; c++) clientInfo->subscriptionHash = (clientInfo->subscriptionHash ^ *c) * 16777619;
+      clientInfo->subscriptionHash = (clientInfo->subscriptionHash ^ ',') * 16777619;
+
+      VectorString subscriptionName;
+      strlcpy(subscriptionName.s, name, sizeof(subscriptionName.s));
+      clientInfo->subscriptions.push_back(subscriptionName);
     }
-    else {
-      ppf("sendDataWs WS buffer allocation failed\n");
-      ws.closeAll(1013); //code 1013 = temporary overload, try again later
-      ws.cleanupClients(0); //disconnect ALL clients to release memory
-      ws._cleanBuffers();
+    resolveSubscriptions(*clientInfo);
+    ppf("subscribe client:%d #:%d pids:%d\n", client->id(), subscriptions.size(), clientInfo->pids.size());
+  }
+
+  xSemaphoreGive(wsMutex);
+}
+
+//wsMutex taken by caller
+void SysModWeb::resolveSubscriptions(WebClientInfo &clientInfo) {
+  clientInfo.pids.clear();
+  for (const VectorString &subscription: clientInfo.subscriptions) {
+    VectorString pid;
+    if (strchr(subscription.s, '.')) //pid.id
+      clientInfo.pids.push_back(subscription);
+    else { //module
+      JsonObject moduleVar = mdl->findVar("m", subscription.s);
+      if (!moduleVar.isNull())
+        walkModulePids(moduleVar, [&](const char * id) {
+          strlcpy(pid.s, id, sizeof(pid.s));
+          clientInfo.pids.push_back(pid);
+        });
+      else
+        clientInfo.pids.push_back(subscription); //module not (yet) there, subscribe to its direct variables
+    }
+  }
+}
+
+//same hash is not enough: different subscriptions can collide
+static bool sameSubscriptions(const std::vector<VectorString> &a, const std::vector<VectorString> &b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++)
+    if (strcmp(a[i].s, b[i].s) != 0) return false;
+  return true;
+}
+
+void SysModWeb::addChannel(JsonObject var, uint8_t id, size_t len, uint8_t fps, std::function<void(byte *buffer, size_t len)> fill) {
+  if (id >= 32 || !fps || len > UINT16_MAX) {
+    ppf("dev addChannel %d not 0..31, fps %d or len %d\n", id, fps, len);
+    return;
+  }
+  var["channel"] = id; //index.js enables the channels of the modules shown
+
+  BinaryChannel channel;
+  channel.id = id;
+  channel.len = len;
+  channel.interval = 1000 / fps;
+  channel.fill = fill;
+  channel.frame.resize(len);
+  channel.prev.resize(len);
+  channel.encoded.resize(4 + len + len / 128 + 1); //worst case PackBits
+
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  channels.push_back(channel);
+  xSemaphoreGive(wsMutex);
+}
+
+void SysModWeb::enableChannels(WebClient * client, JsonArray channelIds) {
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  WebClientInfo *clientInfo = findClientInfo(client->id());
+  if (clientInfo) {
+    clientInfo->channels = 0;
+    clientInfo->channelsSynced = 0; //start with a keyframe
+    for (JsonVariant id: channelIds)
+      if (id.as<uint8_t>() < 32) clientInfo->channels |= 1 << id.as<uint8_t>();
+  }
+  xSemaphoreGive(wsMutex);
+}
+
+void SysModWeb::produceChannels() {
+  if (isBusy || channels.empty()) return;
+
+  unsigned long now = millis();
+
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  for (BinaryChannel &channel: channels) {
+    if (now - channel.lastMillis < channel.interval) continue;
+
+    uint32_t mask = 1 << channel.id;
+    bool enabled = false;
+    for (const WebClientInfo &clientInfo: clientInfos)
+      if (clientInfo.channels & mask) enabled = true;
+    if (!enabled) continue;
+
+    channel.lastMillis = now;
+
+    channel.frame[0] = channel.id;
+    channel.fill(channel.frame.data(), channel.len);
+
+    //keyframes for clients which are not synced (new or missed a frame), deltas for the others
+    bool keyframe = channel.frameNr++ % keyframeInterval == 0;
+    bool needKey = false;
+    bool needDelta = false;
+    for (const WebClientInfo &clientInfo: clientInfos)
+      if (clientInfo.channels & mask) {
+        if (keyframe || !(clientInfo.channelsSynced & mask)) needKey = true;
+        else needDelta = true;
+      }
+    AsyncWebSocketMessageBuffer *keyBuf = needKey?encodeFrame(channel, false):nullptr;
+    AsyncWebSocketMessageBuffer *deltaBuf = needDelta?encodeFrame(channel, true, keyBuf):nullptr; //not in keyBuf: not sent yet
+    if (keyBuf && (keyBuf == deltaBuf || keyBuf->get()[1] == 2)) { //clients without the previous frame cannot decode a delta
+      ppf("dev produceChannels %d keyframe overwritten by delta\n", channel.id);
+      keyBuf = nullptr; //keyframe next time
+      deltaBuf = nullptr;
+    }
+
+    for (auto &client:ws.getClients()) {
+      WebClientInfo *clientInfo = findClientInfo(client->id());
+      if (!clientInfo || !(clientInfo->channels & mask)) continue;
+      AsyncWebSocketMessageBuffer *wsBuf = (keyframe || !(clientInfo->channelsSynced & mask))?keyBuf:deltaBuf;
+      if (wsBuf && sendBuffer(wsBuf, true, client))
+        clientInfo->channelsSynced |= mask;
+      else
+        clientInfo->channelsSynced &= ~mask; //keyframe next time
+    }
+
+    channel.prev.swap(channel.frame); //the synced clients have this frame now
+  }
+  xSemaphoreGive(wsMutex);
+}
+
+//PackBits: n < 128: n+1 literal bytes follow, n > 128: the next byte 257-n times. Returns 0 if it does not fit
+static size_t packBits(const byte *src, size_t len, byte *dst, size_t maxLen) {
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len) {
+    size_t run = 1;
+    while (i + run < len && run < 128 && src[i + run] == src[i]) run++;
+    if (run >= 3) {
+      if (o + 2 > maxLen) return 0;
+      dst[o++] = 257 - run;
+      dst[o++] = src[i];
+      i += run;
+    }
+    else { //literals until the next run of 3
+      size_t start = i;
+      while (i < len && i - start < 128 && !(i + 2 < len && src[i] == src[i + 1] && src[i] == src[i + 2])) i++;
+      if (o + 1 + i - start > maxLen) return 0;
+      dst[o++] = i - start - 1;
+      memcpy(dst + o, src + start, i - start);
+      o += i - start;
+    }
+  }
+  return o;
+}
+
+AsyncWebSocketMessageBuffer * SysModWeb::encodeFrame(BinaryChannel &channel, bool delta, AsyncWebSocketMessageBuffer *inUse) {
+  //a buffer no client is sending anymore and not inUse (encoded for this frame): if all are still being sent, nullptr
+  bool available = channel.pool.size() < STARBASE_CHANNEL_BUFFERS;
+  for (AsyncWebSocketMessageBuffer *pooled: channel.pool)
+    if (pooled->count() == 0 && pooled != inUse) available = true;
+  if (!available) return nullptr;
+
+  uint32_t cycles = ESP.getCycleCount();
+
+  byte *encoded = channel.encoded.data();
+  const byte *source = channel.frame.data();
+  if (delta) {
+    for (size_t i = 0; i < channel.len; i++) channel.prev[i] ^= channel.frame[i]; //prev is replaced by frame after sending
+    source = channel.prev.data();
+  }
+  size_t len = packBits(source, channel.len, encoded + 4, channel.encoded.size() - 4);
+  encoded[0] = 0x80 | channel.id;
+  encoded[1] = delta?2:1;
+  if (!len || len >= channel.len) { //not smaller: raw
+    memcpy(encoded + 4, channel.frame.data(), channel.len);
+    len = channel.len;
+    encoded[1] = 0;
+  }
+  encoded[2] = channel.len & 0xFF;
+  encoded[3] = channel.len >> 8;
+  len += 4;
+
+  channelEncodeCycles += ESP.getCycleCount() - cycles;
+  channelRawBytes += channel.len;
+  channelEncodedBytes += len;
+
+  //the buffer length is the message length and reserve reallocates: reuse a buffer which is a bit longer (clients ignore bytes after the frame)
+  size_t maxLen = len + len / 4 + 64;
+  AsyncWebSocketMessageBuffer *wsBuf = nullptr;
+  bool fits = false;
+  for (AsyncWebSocketMessageBuffer *pooled: channel.pool) {
+    if (pooled->count() || pooled == inUse) continue;
+    fits = pooled->length() >= len && pooled->length() <= maxLen;
+    if (!wsBuf || fits) wsBuf = pooled;
+    if (fits) break;
+  }
+  if (!fits) {
+    size_t bufLen = (len + 63) & ~63; //in steps, so similar frames fit
+    //a new buffer if the pool is not full: keep the free one for frames of its length
+    AsyncWebSocketMessageBuffer *made = channel.pool.size() < STARBASE_CHANNEL_BUFFERS?ws.makeBuffer(bufLen):nullptr;
+    if (made) {
+      made->lock(); //not removed by _cleanBuffers
+      channel.pool.push_back(made);
+      wsBuf = made;
+    }
+    else if (!wsBuf || !wsBuf->reserve(bufLen))
+      return nullptr;
+  }
+
+  memcpy(wsBuf->get(), encoded, len);
+  memset(wsBuf->get() + len, 0, wsBuf->length() - len);
+  return wsBuf;
+}
+
+bool SysModWeb::isSubscribed(WebClient * client, const char * pid, const char * id) {
+  char pidid[64];
+  print->fFormat(pidid, sizeof(pidid), "%s.%s", pid, id);
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  bool subscribed = isSubscribed(findClientInfo(client->id()), pidid);
+  xSemaphoreGive(wsMutex);
+  return subscribed;
+}
+
+void SysModWeb::walkModulePids(JsonObject moduleVar, std::function<void(const char *)> fun) {
+  fun(Variable(moduleVar).id());
+  for (JsonObject childVar: Variable(moduleVar).children())
+    if (!Variable(childVar).children().isNull()) walkModulePids(childVar, fun);
+}
+
+//FNV-1a
+static uint32_t pidHash(const char * pid, size_t len) {
+  uint32_t hash = 2166136261;
+  for (size_t i = 0; i < len && pid[i]; i++) hash = (hash ^ pid[i]) * 16777619;
+  return hash;
+}
+
+void SysModWeb::sendModules(WebClient * client) {
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+
+  ws.cleanupClients(); //only if above threshold
+
+  //send model per module to stay under websocket size limit of 8192
+  if (buildModuleBlobs()) {
+    for (const ModuleBlob &moduleBlob: moduleBlobs)
+      sendBuffer(moduleBlob.wsBuf, false, client); //the same buffer for all clients
+  }
+  else {
+    ppf("sendModules WS buffer allocation failed\n");
+    clearModuleBlobs();
+    ws.closeAll(1013); //code 1013 = temporary overload, try again later
+    ws.cleanupClients(0); //disconnect ALL clients to release memory
+    ws._cleanBuffers();
+  }
+
+  xSemaphoreGive(wsMutex);
+}
+
+//wsMutex taken by caller
+bool SysModWeb::buildModuleBlobs() {
+  moduleBlobsMillis = millis();
+
+  JsonArray model = mdl->model->as<JsonArray>();
+
+  if (moduleBlobs.size() != model.size()) {
+    clearModuleBlobs();
+
+    //inspired by https://github.com/bblanchon/ArduinoJson/issues/1280
+    //store arrayindex and sort order in vector
+    std::vector<ArrayIndexSortValue> aisvs;
+    size_t index = 0;
+    for (JsonObject moduleVar: model) {
+      ArrayIndexSortValue aisv;
+      aisv.index = index++;
+      aisv.value = Variable(moduleVar).order();
+      aisvs.push_back(aisv);
+    }
+    //sort the vector by the order
+    std::sort(aisvs.begin(), aisvs.end(), [](const ArrayIndexSortValue &a, const ArrayIndexSortValue &b) {return a.value < b.value;});
+
+    for (const ArrayIndexSortValue &aisv : aisvs) {
+      ModuleBlob moduleBlob;
+      moduleBlob.index = aisv.index;
+      walkModulePids(model[aisv.index], [&moduleBlob](const char * pid) {
+        moduleBlob.pidHashes.push_back(pidHash(pid, SIZE_MAX));
+      });
+      moduleBlobs.push_back(moduleBlob);
+    }
+  }
+
+  //serialize the dirty modules
+  for (ModuleBlob &moduleBlob: moduleBlobs) {
+    if (!moduleBlob.wsBuf) {
+      JsonVariant moduleVar = model[moduleBlob.index];
+      size_t len = measureJson(moduleVar);
+      if (len > 8192)
+        ppf("dev sendModules BufferLen too high !!!%d\n", len);
+      moduleBlob.wsBuf = ws.makeBuffer(len); //assert failed: block_trim_free heap_tlsf.c:371 (block_is_free(block) && "block must be free"), AsyncWebSocket::makeBuffer(unsigned int)
+      if (!moduleBlob.wsBuf) return false;
+      moduleBlob.wsBuf->lock(); //keep it until the module changes
+      serializeJson(moduleVar, moduleBlob.wsBuf->get(), len);
+    }
+  }
+  return true;
+}
+
+//wsMutex taken by caller
+bool SysModWeb::moduleBlobsChanged(JsonObject responseObject) {
+  //the blob of the module of pid.id is outdated
+  auto changed = [this](const char * key) {
+    const char * dot = strchr(key, '.');
+    if (!dot || moduleBlobs.empty()) return; //other commands (e.g. sysInfo) don't change the model
+    uint32_t hash = pidHash(key, dot - key);
+    for (ModuleBlob &moduleBlob: moduleBlobs) {
+      if (moduleBlob.wsBuf && std::find(moduleBlob.pidHashes.begin(), moduleBlob.pidHashes.end(), hash) != moduleBlob.pidHashes.end()) {
+        moduleBlob.wsBuf->unlock(); //deleted by _cleanBuffers when send to all clients
+        moduleBlob.wsBuf = nullptr;
+      }
+    }
+  };
+
+  for (JsonPair pair: responseObject) {
+    const char * key = pair.key().c_str();
+    const char * dot = strchr(key, '.');
+    //commands which change the model structure or a module var (order, view, theme): rebuild all
+    if (pair.key() == "details" || pair.key() == "onAdd" || pair.key() == "onDelete" || pair.key() == "view" || pair.key() == "theme" || pair.key() == "canvasData" || (dot && dot - key == 1 && key[0] == 'm')) {
+      if (moduleBlobs.size()) clearModuleBlobs();
+      return true;
+    }
+    if (pair.key() == "updRow") { //rows of tables: {pid.id: {rowNr: [cells]}}
+      for (JsonPair table: pair.value().as<JsonObject>())
+        changed(table.key().c_str());
+    }
+    else
+      changed(key);
+  }
+  return false;
+}
+
+//wsMutex taken by caller
+void SysModWeb::clearModuleBlobs() {
+  for (ModuleBlob &moduleBlob: moduleBlobs)
+    if (moduleBlob.wsBuf) moduleBlob.wsBuf->unlock();
+  moduleBlobs.clear();
+  ws._cleanBuffers();
+}
+
+#ifdef STARBASE_DEVMODE
+void SysModWeb::connectStormBenchmark() {
+  JsonArray model = mdl->model->as<JsonArray>();
+  char result[64] = "";
+
+  for (uint8_t nrOfClients: {1, 5, 10, 20}) {
+    //uncached: each client sorts and serializes all modules
+    uint32_t cycles = ESP.getCycleCount();
+    for (uint8_t client = 0; client < nrOfClients; client++) {
+      std::vector<ArrayIndexSortValue> aisvs;
+      size_t index = 0;
+      for (JsonObject moduleVar: model) aisvs.push_back({index++, (uint32_t)Variable(moduleVar).order()});
+      std::sort(aisvs.begin(), aisvs.end(), [](const ArrayIndexSortValue &a, const ArrayIndexSortValue &b) {return a.value < b.value;});
+      for (const ArrayIndexSortValue &aisv : aisvs) {
+        size_t len = measureJson(model[aisv.index]);
+        uint8_t *buffer = (uint8_t *)malloc(len);
+        if (buffer) serializeJson(model[aisv.index], buffer, len);
+        free(buffer);
+      }
+    }
+    uint32_t uncachedUs = (ESP.getCycleCount() - cycles) / ESP.getCpuFreqMHz();
+
+    //cached: the first client builds the blobs, the others reuse them
+    xSemaphoreTake(wsMutex, portMAX_DELAY);
+    clearModuleBlobs();
+    cycles = ESP.getCycleCount();
+    for (uint8_t client = 0; client < nrOfClients; client++)
+      buildModuleBlobs();
+    uint32_t cachedUs = (ESP.getCycleCount() - cycles) / ESP.getCpuFreqMHz();
+    xSemaphoreGive(wsMutex);
+
+    ppf("connectStorm %d clients: uncached %d µs cached %d µs\n", nrOfClients, uncachedUs, cachedUs);
+    print->fFormat(result, sizeof(result), "%d clients: %d -> %d µs", nrOfClients, uncachedUs, cachedUs);
+  }
+  mdl->setValue("Web", "connectStormResult", JsonString(result));
+}
+#endif
+
+bool SysModWeb::takeTokens(WebClientInfo &clientInfo, size_t bytes) {
+  unsigned long now = millis();
+  float elapsed = (now - clientInfo.tokensMillis) / 1000.0f;
+  clientInfo.tokensMillis = now;
+  clientInfo.commandTokens = min(clientInfo.commandTokens + elapsed * wsCommandsPerSecond, (float)wsCommandsPerSecond);
+  clientInfo.byteTokens = min(clientInfo.byteTokens + elapsed * wsBytesPerSecond, (float)wsBytesPerSecond);
+
+  if (clientInfo.commandTokens < 1 || clientInfo.byteTokens <= 0) return false;
+
+  clientInfo.commandTokens--;
+  clientInfo.byteTokens -= bytes;
+  return true;
+}
+
+bool SysModWeb::floodControl(WebClient * client, JsonObject responseObject, size_t len) {
+  uint8_t dropped = 0;
+
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  WebClientInfo *clientInfo = findClientInfo(client->id());
+  bool overBudget = clientInfo && !takeTokens(*clientInfo, len);
+  if (overBudget) {
+    for (JsonPair pair: responseObject) {
+      if (strchr(pair.key().c_str(), '.')) { //pid.id[#rowNr]: the latest value wins
+        JsonString key(pair.key().c_str(), JsonString::Copied);
+        if (!clientInfo->pending[key].isNull()) wsCoalesced++;
+        clientInfo->pending[key] = pair.value();
+      }
+      else
+        dropped++; //onUI, onAdd, view etc.
+    }
+  }
+  else if (clientInfo && clientInfo->pending.size()) {
+    //processed now: older pending values of the same variables would overwrite it later
+    for (JsonPair pair: responseObject)
+      clientInfo->pending.remove(pair.key());
+  }
+  xSemaphoreGive(wsMutex);
+
+  if (overBudget) {
+    wsDropped += dropped;
+    client->text(dropped?"{\"success\":false}":"{\"success\":true}"); // we have to send something back otherwise WS connection closes
+  }
+  return overBudget;
+}
+
+void SysModWeb::processPendingCommands() {
+  JsonDocument pending;
+
+  xSemaphoreTake(wsMutex, portMAX_DELAY);
+  for (WebClientInfo &clientInfo: clientInfos) {
+    if (clientInfo.pending.size() && takeTokens(clientInfo, 0)) { //bytes already taken when received
+      for (JsonPair pair: clientInfo.pending.as<JsonObject>())
+        pending[JsonString(pair.key().c_str(), JsonString::Copied)] = pair.value();
+      clientInfo.pending.clear();
+    }
+  }
+  xSemaphoreGive(wsMutex);
+
+  if (pending.size()) {
+    ui->processJson(pending.as<JsonVariant>());
+    //the user initiated these changes: one flush right away, ignoring the rate limits (commands are limited per client)
+    if (responseDirtyMillis) flushResponses(true);
+  }
+}
+
+SysModWeb::WebClientInfo * SysModWeb::findClientInfo(uint32_t id) {
+  for (WebClientInfo &clientInfo: clientInfos)
+    if (clientInfo.id == id) return &clientInfo;
+  return nullptr;
+}
+
+bool SysModWeb::isSubscribed(const WebClientInfo * clientInfo, const char * key) {
+  if (!clientInfo || !clientInfo->subscriptionHash) return true;
+
+  const char *dot = strchr(key, '.');
+  if (!dot) return true; //commands like sysInfo, onAdd: always (updRow: per table, see serializeSubscribed)
+  size_t pidLen = dot - key;
+  const char *id = dot + 1;
+  size_t idLen = strcspn(id, "#"); //without rowNr
+
+  for (const VectorString &pid: clientInfo->pids) {
+    if (pidLen == 1 && key[0] == 'm') { //module variable: if the module is subscribed
+      if (strlen(pid.s) == idLen && strncmp(pid.s, id, idLen) == 0) return true;
     }
+    else if (strncmp(pid.s, key, pidLen) == 0) {
+      if (pid.s[pidLen] == '\0') return true; //pid
+      if (pid.s[pidLen] == '.' && strlen(pid.s + pidLen + 1) == idLen && strncmp(pid.s + pidLen + 1, id, idLen) == 0) return true; //pid.id
+    }
+  }
+  return false;
+}
 
-    getResponseDoc()->to<JsonObject>(); //recreate!
+size_t SysModWeb::serializeSubscribed(JsonObject responseObject, const WebClientInfo * clientInfo, uint8_t * buffer) {
+  size_t len = 0;
+  if (buffer) buffer[len] = '{';
+  len++;
+  for (JsonPair pair: responseObject) {
+    const char * key = pair.key().c_str();
+    bool updRow = pair.key() == "updRow"; //rows of tables: {pid.id: {rowNr: [cells]}}, only the subscribed tables
+    size_t rowsLen = updRow?serializeSubscribed(pair.value().as<JsonObject>(), clientInfo, nullptr):0;
+    if (updRow?rowsLen <= 2:!isSubscribed(clientInfo, key)) continue;
+
+    if (len > 1) {
+      if (buffer) buffer[len] = ',';
+      len++;
+    }
+    //keys are pid.id[#rowNr] or commands, no escaping needed
+    size_t keyLen = strlen(key);
+    if (buffer) {
+      buffer[len] = '"';
+      memcpy(buffer + len + 1, key, keyLen);
+      buffer[len + 1 + keyLen] = '"';
+      buffer[len + 2 + keyLen] = ':';
+    }
+    len += keyLen + 3;
+    if (updRow)
+      len += buffer?serializeSubscribed(pair.value().as<JsonObject>(), clientInfo, buffer + len):rowsLen;
+    else
+      len += buffer?serializeJson(pair.value(), buffer + len, measureJson(pair.value())):measureJson(pair.value());
   }
+  if (buffer) buffer[len] = '}';
+  len++;
+  return len;
 }
 
 void SysModWeb::serializeState(JsonVariant root) {
@@ -774,37 +1850,291 @@ void SysModWeb::serializeInfo(JsonVariant root) {
 
 void SysModWeb::serveJson(WebRequest *request) {
 
-  AsyncJsonResponse * response;
-
   // return model.json
   if (request->url().indexOf("mdl") > 0) {
     JsonArray model = mdl->model->as<JsonArray>();
-    ppf("serveJson model ...%d, %s %d %d\n", request->client()->remoteIP()[3], request->url().c_str(), model.size(),  measureJson(model));
+    ppf("serveJson model ...%d, %s %d\n", request->client()->remoteIP()[3], request->url().c_str(), model.size());
+
+    //no copy of the model: stream it module by module and send each in pieces as the TCP send window allows, so only the largest module is in memory
+    //each module is serialized under modelMutex: loopTask does not change it meanwhile. The modules are found by id, as they were at the request
+    struct ModelStream {
+      std::vector<String> ids; //modules to send
+      size_t moduleIndex = 0; //next module to serialize, ids.size(): closing bracket, > ids.size(): done
+      bool opened = false; //[ sent
+      char *buffer = nullptr;
+      size_t length = 0;
+      size_t sent = 0;
+      ~ModelStream() {free(buffer);}
+    };
+    std::shared_ptr<ModelStream> stream = std::make_shared<ModelStream>(); //freed when the response is done or the client disconnects
+
+    if (xSemaphoreTake(mdl->modelMutex, pdMS_TO_TICKS(500)) != pdTRUE) {
+      request->send(503, "text/plain", "model busy");
+      return;
+    }
+    for (JsonObject moduleVar: model)
+      stream->ids.push_back(Variable(moduleVar).id());
+    xSemaphoreGive(mdl->modelMutex);
+
+    WebResponse *response = request->beginChunkedResponse("application/json", [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      size_t written = 0;
+      while (written < maxLen) {
+        if (stream->sent == stream->length) { //serialize the next module
+          size_t nrOfModules = stream->ids.size();
+          if (stream->moduleIndex > nrOfModules) break; //done
+
+          free(stream->buffer);
+          stream->buffer = nullptr;
+          stream->sent = 0;
+          stream->length = 0;
+
+          bool failed = false;
+          if (stream->moduleIndex == nrOfModules) {
+            stream->buffer = (char *)malloc(3);
+            if (stream->buffer) stream->length = strlcpy(stream->buffer, stream->opened?"]":"[]", 3);
+            else failed = true;
+          }
+          else if (xSemaphoreTake(mdl->modelMutex, pdMS_TO_TICKS(500)) == pdTRUE) {
+            JsonVariant moduleVar;
+            for (JsonObject var: mdl->model->as<JsonArray>())
+              if (stream->ids[stream->moduleIndex] == Variable(var).id()) moduleVar = var;
+            if (!moduleVar.isNull()) { //else removed meanwhile: skip
+              size_t len = measureJson(moduleVar);
+              stream->buffer = (char *)malloc(len + 2); //separator and \0
+              if (stream->buffer) {
+                stream->buffer[0] = stream->opened?',':'[';
+                stream->length = serializeJson(moduleVar, stream->buffer + 1, len + 1) + 1;
+                stream->opened = true;
+              }
+              else failed = true;
+            }
+            xSemaphoreGive(mdl->modelMutex);
+          }
+          else failed = true;
+          stream->moduleIndex++;
 
-    response = new AsyncJsonResponse(true); //array, removed size as ArduinoJson v7 doesnt care (tbd: here copy is mode, see WLED for using reference)
-    JsonArray root = response->getRoot();
+          if (failed) {
+            ppf("dev serveJson model stream allocation failed or model busy %d\n", stream->moduleIndex);
+            stream->moduleIndex = nrOfModules + 1; //stop
+            break;
+          }
+        }
+
+        size_t len = min(maxLen - written, stream->length - stream->sent);
+        memcpy(buffer + written, stream->buffer + stream->sent, len);
+        written += len;
+        stream->sent += len;
+      }
+      return written; //0: end of response
+    });
+
+    request->send(response);
+    return;
+  }
 
-    root.set(model);
-  } else { //WLED compatible
-    ppf("serveJson ...%d, %s\n", request->client()->remoteIP()[3], request->url().c_str());
-    response = new AsyncJsonResponse(false); //object. removed size as ArduinoJson v7 doesnt care
-    JsonVariant root = response->getRoot();
+  //WLED compatible
+  uint32_t cycles = ESP.getCycleCount();
+  ppf("serveJson ...%d, %s\n", request->client()->remoteIP()[3], request->url().c_str());
+
+  //temporary set all WLED variables (as otherwise WLED-native does not show the instance): tbd: clean up (state still needed, info not)
+
+  if (wledJsonDirty || !wledJson) {
+    wledJsonDirty = false;
+    JsonDocument doc;
+    serializeState(doc["state"].to<JsonObject>());
+    serializeInfo(doc["info"].to<JsonObject>());
+
+    String state;
+    serializeJson(doc["state"], state);
+    String info;
+    serializeJson(doc["info"], info);
+    //a new string: responses still sending keep the previous one
+    wledJson = std::make_shared<String>("{\"state\":" + state + ",\"info\":" + info + "}");
+    wledStateLength = state.length();
+    wledInfoLength = info.length();
+  }
 
-    //temporary set all WLED variables (as otherwise WLED-native does not show the instance): tbd: clean up (state still needed, info not)
+  std::shared_ptr<String> json = wledJson;
+  size_t offset = 0;
+  size_t length = json->length();
+  if (request->url().indexOf("state") > 0) {
+    offset = strlen("{\"state\":");
+    length = wledStateLength;
+  }
+  else if (request->url().indexOf("info") > 0) {
+    offset = strlen("{\"state\":") + wledStateLength + strlen(",\"info\":");
+    length = wledInfoLength;
+  }
 
-    if (request->url().indexOf("state") > 0) {
-      serializeState(root);
+  WebResponse *response = request->beginResponse("application/json", length, [json, offset, length](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    if (index >= length) return 0;
+    size_t len = min(maxLen, length - index);
+    memcpy(buffer, json->c_str() + offset + index, len);
+    return len;
+  });
+  request->send(response);
+
+  cycles = ESP.getCycleCount() - cycles;
+  wledJsonCounter++;
+  wledJsonCycles += cycles;
+  if (cycles > wledJsonMaxCycles) wledJsonMaxCycles = cycles;
+} //serveJson
+
+SysModWeb::SSESubscriber::~SSESubscriber() {
+  xSemaphoreTake(web->sseMutex, portMAX_DELAY);
+  if (--web->sseSubscribers == 0) {
+    delete[] web->sseEvents;
+    web->sseEvents = nullptr;
+  }
+  xSemaphoreGive(web->sseMutex);
+}
+
+void SysModWeb::measureLatency(WebRequest *request, Histogram &histogram) {
+  //µs: the cycle counters of both cores differ. The connection is closed after the response is send
+  int64_t startUs = esp_timer_get_time();
+  request->onDisconnect([&histogram, startUs]() {
+    histogram.add(esp_timer_get_time() - startUs);
+  });
+}
+
+void SysModWeb::serveMetrics(WebRequest *request) {
+  httpRequests++;
+
+  AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+
+  //counters
+  auto counter = [response](const char * name, const char * help, uint64_t value, const char * labels = "") {
+    if (help) response->printf("# HELP starbase_%s %s\n# TYPE starbase_%s counter\n", name, help, name);
+    response->printf("starbase_%s%s %llu\n", name, labels, value);
+  };
+  counter("ws_sent_messages_total", "Websocket messages send", sendWsCounter.total);
+  counter("ws_sent_bytes_total", "Websocket bytes send", sendWsTBytes.total, "{type=\"text\"}");
+  counter("ws_sent_bytes_total", nullptr, sendWsBBytes.total, "{type=\"binary\"}");
+  counter("ws_received_messages_total", "Websocket messages received", recvWsCounter.total);
+  counter("ws_received_bytes_total", "Websocket bytes received", recvWsBytes.total);
+  counter("ws_command_allocations_total", "Allocations processing websocket commands", recvWsAllocations.total);
+  counter("udp_sent_messages_total", "UDP messages send", sendUDPCounter.total);
+  counter("udp_sent_bytes_total", "UDP bytes send", sendUDPBytes.total);
+  counter("udp_received_messages_total", "UDP messages received", recvUDPCounter.total);
+  counter("udp_received_bytes_total", "UDP bytes received", recvUDPBytes.total);
+  counter("http_requests_total", "HTTP requests", httpRequests.total);
+  counter("http_received_bytes_total", "HTTP body and upload bytes received", httpRecvBytes.total);
+  counter("loops_total", "Main loops", sys->loopsTotal());
+
+  //snapshot: loopTask updates the 64 bit cycles while this runs in async_tcp
+  std::vector<uint64_t> cpuCycles;
+  cpuCycles.reserve(mdls->getModules().size());
+  portENTER_CRITICAL(&sys->countersMux);
+  for (const SysModule *module: mdls->getModules())
+    cpuCycles.push_back(module->cpuCycles);
+  portEXIT_CRITICAL(&sys->countersMux);
+
+  response->printf("# HELP starbase_module_cpu_cycles_total CPU cycles of the module loops\n# TYPE starbase_module_cpu_cycles_total counter\n");
+  for (size_t i = 0; i < cpuCycles.size(); i++)
+    response->printf("starbase_module_cpu_cycles_total{module=\"%s\"} %llu\n", mdls->getModules()[i]->name, cpuCycles[i]);
+
+  response->printf("# HELP starbase_handler_latency_us Handler start till the response is send\n# TYPE starbase_handler_latency_us summary\n");
+  for (Histogram *histogram: latencies) {
+    for (uint8_t percent: {50, 95, 99})
+      response->printf("starbase_handler_latency_us{handler=\"%s\",quantile=\"0.%d\"} %u\n", histogram->name, percent, histogram->percentile(percent));
+    response->printf("starbase_handler_latency_us_sum{handler=\"%s\"} %llu\n", histogram->name, histogram->sum.load());
+    response->printf("starbase_handler_latency_us_count{handler=\"%s\"} %u\n", histogram->name, histogram->count.load());
+  }
+
+  //gauges
+  auto gauge = [response](const char * name, const char * help, uint32_t value) {
+    response->printf("# HELP starbase_%s %s\n# TYPE starbase_%s gauge\nstarbase_%s %u\n", name, help, name, name, value);
+  };
+  gauge("heap_free_bytes", "Free heap", ESP.getFreeHeap());
+  gauge("heap_min_free_bytes", "Lowest free heap since boot", ESP.getMinFreeHeap());
+  gauge("heap_max_alloc_bytes", "Largest heap block", ESP.getMaxAllocHeap());
+  gauge("ws_clients", "Websocket clients", ws.count());
+  gauge("sse_subscribers", "Server-Sent Events subscribers", sseSubscribers);
+  gauge("uptime_seconds", "Uptime", millis() / 1000);
+
+  request->send(response);
+}
+
+void SysModWeb::serveEvents(WebRequest *request) {
+  httpRequests++;
+  std::shared_ptr<SSESubscriber> subscriber = std::make_shared<SSESubscriber>();
+  subscriber->initial = "retry: 2000\n\n";
+
+  if (request->hasParam("vars")) {
+    char vars[128];
+    strlcpy(vars, request->getParam("vars")->value().c_str(), sizeof(vars));
+    char * rest = nullptr;
+    for (char * pidid = strtok_r(vars, ",", &rest); pidid; pidid = strtok_r(nullptr, ",", &rest)) {
+      subscriber->hashes.push_back(pidHash(pidid, SIZE_MAX));
+
+      char * dot = strchr(pidid, '.');
+      if (!dot) continue;
+      *dot = '\0';
+      JsonObject var = mdl->findVar(pidid, dot + 1);
+      *dot = '.';
+      if (var.isNull()) continue;
+      subscriber->initial += "event: ";
+      subscriber->initial += pidid;
+      subscriber->initial += "\ndata: ";
+      serializeJson(Variable(var).getValue(), subscriber->initial);
+      subscriber->initial += "\n\n";
     }
-    else if (request->url().indexOf("info") > 0) {
-      serializeInfo(root);
+  }
+
+  xSemaphoreTake(sseMutex, portMAX_DELAY);
+  if (!sseEvents) sseEvents = new SSEEvent[STARBASE_SSE_EVENTS];
+  sseSubscribers++;
+  subscriber->seq = sseSeq; //from now on
+  xSemaphoreGive(sseMutex);
+
+  ppf("serveEvents ...%d vars:%d #:%d\n", request->client()->remoteIP()[3], subscriber->hashes.size(), sseSubscribers);
+
+  //called by the webserver when the connection can send more, no events: try again later (on the next poll)
+  WebResponse *response = request->beginChunkedResponse("text/event-stream", [this, subscriber](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    size_t written = 0;
+    if (subscriber->initial.length()) {
+      written = min(maxLen, (size_t)subscriber->initial.length());
+      memcpy(buffer, subscriber->initial.c_str(), written);
+      subscriber->initial.remove(0, written);
+      return written;
     }
-    else {
-      root["state"] = ""; root["info"] = ""; //init otherwise result is {}
-      serializeState(root["state"]);
-      serializeInfo(root["info"]);
+
+    xSemaphoreTake(sseMutex, portMAX_DELAY);
+    if (sseSeq - subscriber->seq > STARBASE_SSE_EVENTS) subscriber->seq = sseSeq - STARBASE_SSE_EVENTS; //too slow: skip the overwritten events
+    while (subscriber->seq != sseSeq) {
+      SSEEvent &event = sseEvents[subscriber->seq % STARBASE_SSE_EVENTS];
+      if (subscriber->hashes.empty() || std::find(subscriber->hashes.begin(), subscriber->hashes.end(), event.hash) != subscriber->hashes.end()) {
+        size_t len = strlen(event.text);
+        if (written + len > maxLen) break; //next time
+        memcpy(buffer + written, event.text, len);
+        written += len;
+      }
+      subscriber->seq++;
     }
-  }
+    xSemaphoreGive(sseMutex);
 
-  response->setLength();
+    return written?written:RESPONSE_TRY_AGAIN;
+  });
+  response->addHeader("Cache-Control", "no-cache");
   request->send(response);
-} //serveJson
\ No newline at end of file
+}
+
+void SysModWeb::publishEvents(JsonObject responseObject) {
+  xSemaphoreTake(sseMutex, portMAX_DELAY);
+  if (sseEvents) {
+    for (JsonPair pair: responseObject) {
+      const char * key = pair.key().c_str();
+      JsonVariant value = pair.value()["value"];
+      if (!strchr(key, '.') || value.isNull()) continue; //only values of variables
+
+      SSEEvent &event = sseEvents[sseSeq % STARBASE_SSE_EVENTS];
+      size_t len = snprintf(event.text, sizeof(event.text), "event: %s\ndata: ", key);
+      if (len + measureJson(value) + 3 > sizeof(event.text)) continue; //too big for an event: not published
+      len += serializeJson(value, event.text + len, sizeof(event.text) - len);
+      strlcpy(event.text + len, "\n\n", sizeof(event.text) - len);
+      event.hash = pidHash(key, SIZE_MAX);
+      sseSeq++;
+    }
+  }
+  xSemaphoreGive(sseMutex);
+}
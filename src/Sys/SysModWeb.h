@@ -12,6 +12,8 @@
 #pragma once
 #include "SysModule.h"
 #include "SysModPrint.h"
+#include <memory>
+#include <atomic>
 
 #ifdef STARBASE_USE_Psychic
   #include <PsychicHttp.h>
@@ -34,6 +36,69 @@
   #define WebResponse AsyncWebServerResponse
 #endif
 
+#ifndef STARBASE_RESPONSE_TASKS
+  #define STARBASE_RESPONSE_TASKS 4 //loopTask, async_tcp and room for worker tasks
+#endif
+
+#ifndef STARBASE_CHANNEL_BUFFERS
+  #define STARBASE_CHANNEL_BUFFERS 3 //per binary channel: if all are still being send, frames are skipped
+#endif
+
+// https://arduinojson.org/v7/api/jsondocument/
+//responseDoc allocator which counts allocations (e.g. allocations per command)
+struct Counting_Allocator: ArduinoJson::Allocator {
+  uint32_t allocations = 0;
+  void* allocate(size_t size) override {
+    allocations++;
+    return malloc(size);
+  }
+  void deallocate(void* pointer) override {
+    free(pointer);
+  }
+  void* reallocate(void* ptr, size_t new_size) override {
+    allocations++;
+    return realloc(ptr, new_size);
+  }
+};
+
+//monotonic 64 bit counter (does not wrap), delta: increase since the previous delta (e.g. per second in the UI)
+struct Counter {
+  std::atomic<uint64_t> total{0};
+  uint64_t previous = 0;
+  void operator++(int) {total++;}
+  void operator+=(uint64_t value) {total += value;}
+  uint32_t delta() {
+    uint64_t current = total;
+    uint32_t result = current - previous;
+    previous = current;
+    return result;
+  }
+};
+
+//latency histogram: bucket n counts durations of 2^(n-1) to 2^n-1 µs, bucket 0: 0 µs
+struct Histogram {
+  const char * name;
+  std::atomic<uint32_t> buckets[33] = {};
+  std::atomic<uint64_t> sum{0}; //µs
+  std::atomic<uint32_t> count{0};
+  explicit Histogram(const char * name): name(name) {}
+  void add(uint32_t us) {
+    buckets[us?32 - __builtin_clz(us):0]++;
+    sum += us;
+    count++;
+  }
+  //upper bound of the bucket with the percentile, in µs
+  uint32_t percentile(uint8_t percent) {
+    uint32_t target = max(((uint64_t)count * percent + 99) / 100, (uint64_t)1);
+    uint32_t cumulative = 0;
+    for (uint8_t bucket = 0; bucket < 33; bucket++) {
+      cumulative += buckets[bucket];
+      if (cumulative >= target) return bucket?(uint32_t)((1ULL << bucket) - 1):0;
+    }
+    return 0;
+  }
+};
+
 class SysModWeb:public SysModule {
 
 public:
@@ -47,18 +112,47 @@ public:
 
   SemaphoreHandle_t wsMutex = xSemaphoreCreateMutex();
 
-  uint8_t sendWsCounter = 0;
-  uint16_t sendWsTBytes = 0;
-  uint16_t sendWsBBytes = 0;
-  uint8_t recvWsCounter = 0;
-  uint16_t recvWsBytes = 0;
-  uint8_t sendUDPCounter = 0;
-  uint16_t sendUDPBytes = 0;
-  uint8_t recvUDPCounter = 0;
-  uint16_t recvUDPBytes = 0;
+  //see /metrics
+  Counter sendWsCounter;
+  Counter sendWsTBytes;
+  Counter sendWsBBytes;
+  Counter recvWsCounter;
+  Counter recvWsBytes;
+  Counter recvWsAllocations; //allocations of processed commands (deserialize, process and response)
+  Counter sendUDPCounter;
+  Counter sendUDPBytes;
+  Counter recvUDPCounter;
+  Counter recvUDPBytes;
+  Counter httpRequests;
+  Counter httpRecvBytes; //bodies and uploads
+
+  //handler start till the response is send (http: connection closed after the response, ws: send queued)
+  Histogram latencyServeJson{"serveJson"};
+  Histogram latencyJsonHandler{"jsonHandler"};
+  Histogram latencyServeFiles{"serveFiles"};
+  Histogram latencyServeApi{"serveApi"};
+  Histogram latencyWsCommand{"wsCommand"};
+  Histogram *latencies[5] = {&latencyServeJson, &latencyJsonHandler, &latencyServeFiles, &latencyServeApi, &latencyWsCommand};
+  //record the latency of the request in histogram when it is send
+  void measureLatency(WebRequest *request, Histogram &histogram);
 
   bool isBusy = false;
 
+  //loopTask responses are flushed on the next 20ms tick if dirty, within these limits (changes the user initiated are flushed right away)
+  uint8_t flushMaxPerSecond = 25;
+  uint32_t flushMaxBytesPerSecond = 32768;
+
+  //per client token buckets (burst: one second), over budget value updates are coalesced and processed later, other commands dropped
+  uint8_t wsCommandsPerSecond = 30;
+  uint16_t wsBytesPerSecond = 8192;
+  uint16_t wsCoalesced = 0;
+  uint16_t wsDropped = 0;
+
+  uint8_t keyframeInterval = 50; //binary channel frames, clients which missed a frame get a keyframe right away
+  uint32_t channelRawBytes = 0;
+  uint32_t channelEncodedBytes = 0;
+  uint32_t channelEncodeCycles = 0;
+
   #ifdef STARBASE_USERMOD_LIVE
     char lastFileUpdated[30] = ""; //workaround!
   #endif
@@ -67,7 +161,7 @@ public:
 
   void setup() override;
   void loop20ms() override;
-  void loop1s() override;
+  void loop10s() override;
 
   void reboot() override;
 
@@ -78,12 +172,13 @@ public:
   //send json to client or all clients
   void sendDataWs(JsonVariant json = JsonVariant(), WebClient * client = nullptr);
   void sendDataWs(std::function<void(AsyncWebSocketMessageBuffer *)> fill, size_t len, bool isBinary, WebClient * client = nullptr);
-  void sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, WebClient * client = nullptr, bool lossless = true);
+  //returns false if not send to (one of) the client(s)
+  bool sendBuffer(AsyncWebSocketMessageBuffer * wsBuf, bool isBinary, WebClient * client = nullptr, bool lossless = true);
 
   //add an url to the webserver to listen to
   void serveIndex(WebRequest *request);
   void serveNewUI(WebRequest *request);
-  //mdl and WLED style state and info
+  //mdl and WLED style state and info (WLED: prebuilt, rebuilt only if brightness, on or name changed)
   void serializeState(JsonVariant root);
   void serializeInfo(JsonVariant root);
   void serveJson(WebRequest *request);
@@ -94,7 +189,27 @@ public:
   // curl -s -F "update=@/Users/ewoudwijma/Developer/GitHub/ewowi/StarBase/.pio/build/esp32dev/firmware.bin" 192.168.1.102/update /dev/null &
   // curl -s -F "update=@/Users/ewoudwijma/Downloads/StarLight_24110513_esp32devICVLD.bin" 192.168.1.245/update /dev/null &
   void serveUpdate(WebRequest *request, const String& fileName, size_t index, byte *data, size_t len, bool final);
+  // curl -r 0-1023 192.168.1.213/file/F_Panel2x2-16x16.json (Range: single range, 206 reply)
   void serveFiles(WebRequest *request);
+  // curl -T part.json "192.168.1.213/file/F_Panel2x2-16x16.json?offset=1024" (PUT: write the body at offset, the file ends after it, no offset: the whole file)
+  void serveFileWrite(WebRequest *request, byte *data, size_t len, size_t index, size_t total);
+  void serveFileWritten(WebRequest *request);
+  const char * contentType(const char * path);
+
+  //single variables, resolved directly (no processJson), several ids: {"id":value,...}
+  // curl 192.168.1.213/api/System/name,uptime
+  // curl -X PUT 192.168.1.213/api/Fixture/brightness -d 20 -H "Content-Type: application/json" (row: /api/<pid>/<id>/<rowNr>)
+  //   the body must be json (curl -d without content type is form data, not passed to serveApiBody)
+  void serveApi(WebRequest *request);
+  void serveApiBody(WebRequest *request, byte *data, size_t len, size_t index, size_t total);
+
+  //counters and gauges in Prometheus text format
+  // curl 192.168.1.213/metrics
+  void serveMetrics(WebRequest *request);
+
+  //Server-Sent Events: read-only variable updates as text events (event: pid.id, data: value), vars: the variables to stream (first their current value), no vars: all
+  // curl -N "192.168.1.213/events?vars=System.uptime,Fixture.brightness"
+  void serveEvents(WebRequest *request);
 
   //processJsonUrl handles requests send in javascript using fetch and from a browser or curl
   //try this !!!: 
@@ -119,6 +234,11 @@ public:
 
   bool captivePortal(WebRequest *request);
 
+  //conditional GET: if the client already has eTag, reply 304 (a few hundred bytes instead of the content) and return true
+  bool handleIfNoneMatchCacheHeader(WebRequest *request, const char * eTag);
+  //eTag and Cache-Control, immutable if the content never changes for this url (e.g. hashed svelte assets)
+  void setStaticContentCacheHeaders(WebResponse *response, const char * eTag, bool immutable = false);
+
   template <typename Type>
   void addResponse(const JsonObject var, const char * key, Type value, const uint8_t rowNr = UINT8_MAX) {
     JsonObject responseObject = getResponseObject();
@@ -149,9 +269,29 @@ public:
   void clientsToJson(JsonArray array, bool nameOnly = false, const char * filter = nullptr);
 
   //gets the right responseDoc, depending on which task you are in, alternative for requestJSONBufferLock
+  //each task gets its own responseDoc on first use, loopTask sends the responses of tasks which do not send them (see flushTaskResponses)
+  //if more tasks than STARBASE_RESPONSE_TASKS, they wait until the slot of a task which stopped writing responses is released
   JsonDocument * getResponseDoc();
   JsonObject getResponseObject();
-  void sendResponseObject(WebClient * client = nullptr);
+  //returns the nr of bytes send
+  size_t sendResponseObject(WebClient * client = nullptr);
+  size_t sendResponseObject(JsonObject responseObject, WebClient * client = nullptr);
+
+  //flush the loopTask responses if dirty, immediate: ignore the rate limits (once per tick, after processing the pending commands)
+  void flushResponses(bool immediate = false);
+
+  //send the definition of all modules to a (new) client, serialized once and shared by all connecting clients
+  void sendModules(WebClient * client);
+
+  //clients send {"subscribe":["Pins","System.name"]} (modules or pid.id) to only receive broadcasts for what they show, [] for everything
+  void subscribe(WebClient * client, JsonArray subscriptions);
+  bool isSubscribed(WebClient * client, const char * pid, const char * id);
+
+  //binary channels: buffer[0] is the channel id (0..31), fill sets the rest of the buffer, send fps times per second to the clients which enabled the channel
+  //var (e.g. a canvas) gets the channel id, clients enable channels with {"channels":[0,3]}
+  //frames are send encoded: [0] 0x80 | id, [1] type (0 raw, 1 keyframe, 2 delta), [2..3] length of the frame, PackBits of the frame or of frame XOR previous frame, zero padded (buffers are reused)
+  void addChannel(JsonObject var, uint8_t id, size_t len, uint8_t fps, std::function<void(byte *buffer, size_t len)> fill);
+  void enableChannels(WebClient * client, JsonArray channelIds);
 
   void printClient(const char * text, WebClient * client) {
     ppf("%s client: %d ip:%s q:%d l:%d s:%d (#:%d)\n", text, client?client->id():-1, client?client->remoteIP().toString().c_str():"", client->queueIsFull(), client->queueLen(), client->status(), client->server()->count());
@@ -163,8 +303,121 @@ private:
 
   bool clientsChanged = false;
 
-  JsonDocument *responseDocLoopTask = nullptr;
-  JsonDocument *responseDocAsyncTCP = nullptr;
+  struct WebClientInfo {
+    uint32_t id = 0; //client->id()
+    uint32_t subscriptionHash = 0; //0: not subscribed, receives everything. Clients with the same subscriptions receive the same broadcast buffer
+    std::vector<VectorString> subscriptions; //modules and pid.id's as subscribed
+    std::vector<VectorString> pids; //pids of all variables in the subscribed modules and subscribed pid.id's, resolved again if the model structure changes
+    float commandTokens = 0;
+    float byteTokens = 0; //can become negative for a big command
+    unsigned long tokensMillis = 0;
+    JsonDocument pending; //coalesced value updates {"pid.id":value}, processed by processPendingCommands
+    uint32_t channels = 0; //bit per enabled binary channel
+    uint32_t channelsSynced = 0; //bit per channel: has the previous frame, can receive a delta
+  };
+  std::vector<WebClientInfo> clientInfos; //protected by wsMutex
+
+  void resolveSubscriptions(WebClientInfo &clientInfo); //subscriptions to pids
+  //call fun for the module and each variable with children: these are the pids of all variables of the module
+  void walkModulePids(JsonObject moduleVar, std::function<void(const char *)> fun);
+
+  struct ModuleBlob {
+    size_t index = 0; //of the module in the model
+    AsyncWebSocketMessageBuffer *wsBuf = nullptr; //serialized module, locked while cached, nullptr: dirty
+    std::vector<uint32_t> pidHashes; //to find the module of a changed variable
+  };
+  std::vector<ModuleBlob> moduleBlobs; //in module order, empty: rebuild. Protected by wsMutex
+  unsigned long moduleBlobsMillis = 0; //last used, released if not used for a while
+  bool buildModuleBlobs();
+  bool moduleBlobsChanged(JsonObject responseObject); //responses tell which modules changed, true if the model structure changed
+  void clearModuleBlobs();
+
+  struct BinaryChannel {
+    uint8_t id = 0;
+    size_t len = 0;
+    uint16_t interval = 0; //ms
+    unsigned long lastMillis = 0;
+    std::function<void(byte *buffer, size_t len)> fill;
+    std::vector<AsyncWebSocketMessageBuffer *> pool; //locked, reused when no client is sending it anymore, max STARBASE_CHANNEL_BUFFERS
+    std::vector<byte> frame; //filled by the producer
+    std::vector<byte> prev; //frame send before, base of the deltas
+    std::vector<byte> encoded;
+    uint16_t frameNr = 0;
+  };
+  std::vector<BinaryChannel> channels; //protected by wsMutex
+  void produceChannels();
+  //encode the frame of the channel in a buffer of the pool, nullptr if no buffer available
+  AsyncWebSocketMessageBuffer * encodeFrame(BinaryChannel &channel, bool delta, AsyncWebSocketMessageBuffer *inUse = nullptr);
+
+  //WLED compatible {"state":...,"info":...}, state and info are served as part of it
+  std::shared_ptr<String> wledJson;
+  size_t wledStateLength = 0;
+  size_t wledInfoLength = 0;
+  bool wledJsonDirty = true;
+  uint16_t wledJsonCounter = 0;
+  uint32_t wledJsonCycles = 0;
+  uint32_t wledJsonMaxCycles = 0;
+
+  #ifdef STARBASE_DEVMODE
+    bool doConnectStorm = false;
+    void connectStormBenchmark();
+  #endif
+
+  WebClientInfo * findClientInfo(uint32_t id);
+  bool takeTokens(WebClientInfo &clientInfo, size_t bytes); //false if over budget
+  //returns true if the client is over budget: value updates are added to pending, other commands are dropped
+  bool floodControl(WebClient * client, JsonObject responseObject, size_t len);
+  void processPendingCommands();
+  bool isSubscribed(const WebClientInfo * clientInfo, const char * key); //key: pid.id[#rowNr] or a command (always subscribed)
+  //serialize only the responses the client is subscribed to (updRow: the rows of subscribed tables), buffer nullptr: measure
+  size_t serializeSubscribed(JsonObject responseObject, const WebClientInfo * clientInfo, uint8_t * buffer);
+
+  //events are serialized once in a ring, each subscriber has a cursor in the ring
+  #define STARBASE_SSE_EVENTS 32
+  struct SSEEvent {
+    uint32_t hash = 0; //of pid.id
+    char text[128] = "";
+  };
+  SSEEvent *sseEvents = nullptr; //allocated while there are subscribers
+  uint32_t sseSeq = 0; //nr of events published
+  volatile uint8_t sseSubscribers = 0;
+  SemaphoreHandle_t sseMutex = xSemaphoreCreateMutex();
+  struct SSESubscriber {
+    uint32_t seq = 0; //next event to send
+    std::vector<uint32_t> hashes; //empty: all
+    String initial; //current values, send first
+    ~SSESubscriber(); //when the connection is closed
+  };
+  void publishEvents(JsonObject responseObject);
+
+  struct TaskResponseDoc {
+    bool claimed = false; //under responseDocsMux
+    bool replying = false; //the task sends the doc itself (beginResponse till sendResponseObject), under responseDocsMux
+    bool dirty = false; //written since swapped out
+    bool quiet = false; //not written during the last tick: released the next tick
+    bool keep = false; //tasks which reply to requests keep their slot
+    TaskHandle_t task = nullptr; //set when the docs are there
+    JsonDocument *doc = nullptr;
+    JsonDocument *flushing = nullptr; //swapped out by flushTaskResponses, sent the tick after
+    Counting_Allocator allocator;
+  };
+  TaskResponseDoc responseDocs[STARBASE_RESPONSE_TASKS];
+  portMUX_TYPE responseDocsMux = portMUX_INITIALIZER_UNLOCKED;
+  TaskResponseDoc * getTaskResponseDoc();
+  //a request or command: its responses are send by the task itself (sendResponseObject), not by flushTaskResponses
+  TaskResponseDoc * beginResponse();
+  void endResponse(TaskResponseDoc *responseDoc);
+  //loopTask: each tick, swap out the docs other tasks wrote to and send them the tick after, when writes in progress are done
+  //no lock is held by the writing task, slots not written for a tick are released
+  void flushTaskResponses();
+  JsonDocument *responseDocLoopTask = nullptr; //responseDocs[0], flushed by flushResponses
+
+  unsigned long responseDirtyMillis = 0; //first change in responseDocLoopTask since last flush, 0 if not dirty
+  uint16_t flushCounter = 0; //per second, including the immediate flushes
+  uint32_t flushBytes = 0;
+  uint16_t flushLatencies[32] = {0}; //change to flush in ms, last 32 flushes
+  uint8_t flushLatencyIndex = 0;
+  uint8_t flushLatencyCount = 0;
 
 };
 
@@ -0,0 +1,779 @@
+/*
+   @title     StarBase
+   @file      SysStarSync.h
+   @date      20241219
+   @repo      https://github.com/ewoudwijma/StarBase, submit changes to this file as PRs to ewowi/StarBase
+   @Authors   https://github.com/ewoudwijma/StarBase/commits/main
+   @Copyright © 2024 Github StarBase Commit Authors
+   @license   GNU GENERAL PUBLIC LICENSE Version 3, 29 June 2007
+   @license   For non GPL-v3 usage, commercial licenses must be purchased. Contact moonmodules@icloud.com
+*/
+
+#pragma once
+
+//Instance sync protocol parts without Arduino dependencies, used by SysModInstances and by the host tools (tools/)
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//binary dash payload in UDPStarMessage.jsonString: TLV (type length value) keyed by compact variable ids
+//  header: magic, version, flags, count
+//  entry:  key (2 bytes, little endian), type, length, value (length bytes)
+//a json payload starts with '{' so receivers can tell both apart
+
+#define STARSYNC_MAGIC 0xB5
+#define STARSYNC_VERSION 1
+#define STARSYNC_FULL 0x01 //flags: all dash values (else only the changed ones)
+#define STARSYNC_NACK 0x02 //flags: request to resend missing change messages
+#define STARSYNC_RETRANSMIT 0x04 //flags: resent change message, with the current values
+#define STARSYNC_TIME 0x08 //flags: clock request (t1) or response (t1, t2, t3)
+#define STARSYNC_MULTICAST 0x10 //flags: announce: the sender receives group messages (multicast mode)
+
+//keys 0..15 are protocol entries
+#define STARSYNC_KEY_SEQ 1 //change message: its sequence number, announce: the last one sent, nack: the last one received
+#define STARSYNC_KEY_MISSING 2 //nack: bitmap of missing sequence numbers, bit n is seq - n
+#define STARSYNC_KEY_OFFSET 3 //announce: clock offset to the group master in µs
+#define STARSYNC_KEY_JITTER 4 //announce: jitter of the clock offset in µs
+#define STARSYNC_KEY_T1 5 //clock: request sent (requester clock, µs)
+#define STARSYNC_KEY_T2 6 //clock: request received (master clock, µs)
+#define STARSYNC_KEY_T3 7 //clock: response sent (master clock, µs)
+#define STARSYNC_KEY_INTERVAL 8 //announce: max ms till the next announce of the sender (announceMax of its fleet)
+
+enum TLVTypes {
+  tlvNull,
+  tlvBool,
+  tlvUInt, //1, 2 or 4 bytes
+  tlvInt, //1, 2 or 4 bytes
+  tlvFloat, //4 bytes
+  tlvString, //no 0 terminator
+  tlvJson //fallback for arrays and objects
+};
+
+//length of the group of an instance name: the part before the - (group-instance), 0: no group
+inline size_t groupLength(const char *name) {
+  if (!name) return 0;
+  const char *start = name;
+  while (*start == '-') start++;
+  const char *dash = strchr(start, '-');
+  if (!*start || !dash) return 0;
+  const char *rest = dash;
+  while (*rest == '-') rest++;
+  if (!*rest) return 0; //nothing after the -
+  return dash - name;
+}
+
+//FNV-1a of the group of an instance name, 0: no group
+inline uint32_t groupHash(const char *name) {
+  size_t len = groupLength(name);
+  if (!len) return 0;
+
+  uint32_t hash = 2166136261;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ name[i]) * 16777619;
+  return hash?hash:1;
+}
+
+//both names in the same group: compare the groups themselves as hashes can collide
+inline bool sameGroupName(const char *a, const char *b) {
+  size_t len = groupLength(a);
+  return len && len == groupLength(b) && strncmp(a, b, len) == 0;
+}
+
+#define STARSYNC_GROUP_PORT 65507 //multicast port of group messages
+#define STARSYNC_MESSAGE_SIZE 1460 //change messages: one UDP frame
+
+//multicast address of a group (hash of the group in group-instance names): 239.255.x.y (organization local scope)
+inline void groupAddress(uint32_t groupHash, uint8_t address[4]) {
+  uint16_t folded = (groupHash >> 16) ^ (groupHash & 0xFFFF);
+  address[0] = 239;
+  address[1] = 255;
+  address[2] = folded >> 8;
+  address[3] = folded & 0xFF;
+}
+
+//compact id of pid.id: FNV-1a folded to 16 bits, not a protocol key
+inline uint16_t tlvKey(const char *pid, const char *id) {
+  uint32_t hash = 2166136261;
+  for (const char *c = pid; c && *c; c++) hash = (hash ^ *c) * 16777619;
+  hash = (hash ^ '.') * 16777619;
+  for (const char *c = id; c && *c; c++) hash = (hash ^ *c) * 16777619;
+  uint16_t key = (hash >> 16) ^ (hash & 0xFFFF);
+  return key < 16?key + 16:key;
+}
+
+struct TLVValue {
+  uint16_t key;
+  uint8_t type;
+  uint8_t len;
+  const uint8_t *data;
+
+  uint32_t asUInt() const {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < len && i < 4; i++) value |= (uint32_t)data[i] << (8 * i);
+    return value;
+  }
+  int32_t asInt() const {
+    uint32_t value = asUInt();
+    if (len && len < 4 && (data[len-1] & 0x80)) value |= UINT32_MAX << (8 * len); //sign extend
+    return (int32_t)value;
+  }
+  float asFloat() const {
+    float value = 0;
+    if (len == sizeof(float)) memcpy(&value, data, sizeof(float));
+    return value;
+  }
+};
+
+class TLVWriter {
+public:
+  TLVWriter(uint8_t *buffer, size_t size, uint8_t flags):buffer(buffer), size(size) {
+    if (size < 4) {overflow = true; return;}
+    buffer[0] = STARSYNC_MAGIC;
+    buffer[1] = STARSYNC_VERSION;
+    buffer[2] = flags;
+    buffer[3] = 0;
+    len = 4;
+  }
+
+  //returns false if the buffer is full (the entry is not added)
+  bool add(uint16_t key, uint8_t type, const void *data, size_t dataLen) {
+    if (overflow || dataLen > UINT8_MAX || buffer[3] == UINT8_MAX || len + 4 + dataLen > size) {overflow = true; return false;}
+    buffer[len++] = key & 0xFF;
+    buffer[len++] = key >> 8;
+    buffer[len++] = type;
+    buffer[len++] = dataLen;
+    if (dataLen) memcpy(buffer + len, data, dataLen);
+    len += dataLen;
+    buffer[3]++;
+    return true;
+  }
+
+  bool addNull(uint16_t key) {return add(key, tlvNull, nullptr, 0);}
+  bool addBool(uint16_t key, bool value) {uint8_t b = value; return add(key, tlvBool, &b, 1);}
+  bool addUInt(uint16_t key, uint32_t value) {uint8_t data[4]; return add(key, tlvUInt, data, encodeUInt(value, data));}
+  bool addInt(uint16_t key, int32_t value) {uint8_t data[4]; return add(key, tlvInt, data, encodeInt(value, data));}
+  bool addFloat(uint16_t key, float value) {return add(key, tlvFloat, &value, sizeof(float));}
+  bool addString(uint16_t key, const char *value, uint8_t type = tlvString) {return add(key, type, value, value?strlen(value):0);}
+
+  //little endian in as few bytes as possible, returns the number of bytes
+  static size_t encodeUInt(uint32_t value, uint8_t *data) {
+    for (uint8_t i = 0; i < 4; i++) data[i] = value >> (8 * i);
+    return value <= UINT8_MAX?1:value <= UINT16_MAX?2:4;
+  }
+  static size_t encodeInt(int32_t value, uint8_t *data) {
+    encodeUInt((uint32_t)value, data);
+    return (value >= INT8_MIN && value <= INT8_MAX)?1:(value >= INT16_MIN && value <= INT16_MAX)?2:4;
+  }
+
+  size_t length() const {return len;}
+  uint8_t count() const {return buffer[3];}
+  bool full() const {return overflow;}
+
+private:
+  uint8_t *buffer;
+  size_t size;
+  size_t len = 0;
+  bool overflow = false;
+};
+
+class TLVReader {
+public:
+  TLVReader(const uint8_t *buffer, size_t size):buffer(buffer), size(size) {
+    valid = size >= 4 && buffer[0] == STARSYNC_MAGIC && buffer[1] == STARSYNC_VERSION;
+    pos = 4;
+  }
+
+  static bool isTLV(const uint8_t *buffer, size_t size) {return size >= 4 && buffer[0] == STARSYNC_MAGIC;}
+
+  bool isValid() const {return valid;}
+  bool isFull() const {return valid && (buffer[2] & STARSYNC_FULL);}
+  uint8_t flags() const {return valid?buffer[2]:0;}
+  uint8_t count() const {return valid?buffer[3]:0;}
+
+  //returns false at the end or if the entry is truncated
+  bool next(TLVValue &value) {
+    if (!valid || pos >= size) return false;
+    if (pos + 4 > size) {valid = false; return false;}
+    value.key = buffer[pos] | (buffer[pos+1] << 8);
+    value.type = buffer[pos+2];
+    value.len = buffer[pos+3];
+    if (pos + 4 + value.len > size) {valid = false; return false;}
+    value.data = buffer + pos + 4;
+    pos += 4 + value.len;
+    return true;
+  }
+
+private:
+  const uint8_t *buffer;
+  size_t size;
+  size_t pos;
+  bool valid;
+};
+
+//remembers what has been sent per key, so an announce only needs the changes
+class TLVDelta {
+public:
+  //true if the value differs from the last one marked as sent
+  bool changed(uint16_t key, uint8_t type, const void *data, size_t dataLen) const {
+    auto found = sent.find(key);
+    return found == sent.end() || found->second != hash(type, data, dataLen);
+  }
+  void markSent(uint16_t key, uint8_t type, const void *data, size_t dataLen) {sent[key] = hash(type, data, dataLen);}
+  void clear() {sent.clear();}
+
+private:
+  std::unordered_map<uint16_t, uint32_t> sent; //key -> hash of type and value
+
+  static uint32_t hash(uint8_t type, const void *data, size_t dataLen) {
+    uint32_t hash = (2166136261 ^ type) * 16777619;
+    for (size_t i = 0; i < dataLen; i++) hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619;
+    return hash;
+  }
+};
+
+//changed variables waiting to be sent, each key only once: the latest value is read when sending
+template <size_t N>
+class ChangeRing {
+public:
+  //returns false if full (the change is not queued)
+  bool push(uint16_t key) {
+    for (size_t i = 0; i < count; i++)
+      if (keys[(head + i) % N] == key) return true; //already queued
+    if (count == N) return false;
+    keys[(head + count) % N] = key;
+    count++;
+    return true;
+  }
+
+  bool pop(uint16_t &key) {
+    if (!count) return false;
+    key = keys[head];
+    head = (head + 1) % N;
+    count--;
+    return true;
+  }
+
+  //put back at the front, e.g. when it did not fit in a message
+  void unpop() {
+    if (count == N) return;
+    head = (head + N - 1) % N;
+    count++;
+  }
+
+  size_t size() const {return count;}
+  void clear() {head = 0; count = 0;}
+
+private:
+  uint16_t keys[N];
+  size_t head = 0;
+  size_t count = 0;
+};
+
+//sequence numbers received from one sender, with a window of the last 32 to detect gaps
+class SeqTracker {
+public:
+  //returns false if the message should be ignored: duplicate, too old, or a late original (only a retransmit repairs a gap)
+  bool receive(uint16_t seq, bool retransmit = false) {
+    if (!started) {started = true; next = seq + 1; missing = 0; return true;}
+    int16_t ahead = seq - next;
+    if (ahead >= 0) {
+      shift(ahead + 1);
+      for (int bit = 1; bit <= ahead && bit < 32; bit++) missing |= 1UL << bit; //skipped
+      next = seq + 1;
+      return true;
+    }
+    uint16_t behind = next - 1 - seq; //bit in missing
+    if (behind > 1024) {next = seq + 1; missing = 0; return true;} //sender restarted
+    if (behind < 32 && (missing & (1UL << behind)) && retransmit) {
+      missing &= ~(1UL << behind);
+      return true;
+    }
+    return false;
+  }
+
+  //the sender announced its last sequence number: all not received yet are missing
+  void expect(uint16_t last) {
+    if (!started) {started = true; next = last + 1; missing = 0; return;}
+    int16_t ahead = last - next;
+    if (ahead < 0) return;
+    shift(ahead + 1);
+    for (int bit = 0; bit <= ahead && bit < 32; bit++) missing |= 1UL << bit;
+    next = last + 1;
+  }
+
+  //all values up to last are known (full state received): continue from there, also if last is lower (sender restarted)
+  void synced(uint16_t last) {
+    started = true;
+    next = last + 1;
+    missing = 0;
+  }
+
+  //the sender restarted: start again at its next message
+  void reset() {started = false; missing = 0;}
+
+  uint16_t last() const {return next - 1;}
+  uint32_t missingBits() const {return missing;}
+
+private:
+  bool started = false;
+  uint16_t next = 0; //expected sequence number
+  uint32_t missing = 0; //bit n: next - 1 - n not received
+
+  void shift(int n) {missing = n >= 32?0:missing << n;}
+};
+
+//the keys of the last N change messages, to resend them on request
+template <size_t N>
+class SentHistory {
+public:
+  void add(uint16_t seq, const std::vector<uint16_t> &keys) {
+    seqs[head] = seq;
+    entries[head] = keys;
+    used[head] = true;
+    head = (head + 1) % N;
+  }
+
+  //nullptr if not (anymore) in the history
+  const std::vector<uint16_t> *find(uint16_t seq) const {
+    for (size_t i = 0; i < N; i++)
+      if (used[i] && seqs[i] == seq) return &entries[i];
+    return nullptr;
+  }
+
+private:
+  uint16_t seqs[N];
+  std::vector<uint16_t> entries[N];
+  bool used[N] = {};
+  size_t head = 0;
+};
+
+//clock offset to the group master from ntp style request / response exchanges, times in µs (wrapping)
+//the sample with the lowest round trip delay is used (least queueing), jitter is the rms of the offsets to it
+template <size_t N>
+class ClockFilter {
+public:
+  //t1: request sent, t4: response received (own clock), t2: request received, t3: response sent (master clock)
+  void add(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4) {
+    int32_t delay = (int32_t)(t4 - t1) - (int32_t)(t3 - t2);
+    if (delay < 0) delay = 0; //clock resolution
+    samples[head].offset = ((int64_t)(int32_t)(t2 - t1) + (int32_t)(t3 - t4)) / 2;
+    samples[head].delay = delay;
+    head = (head + 1) % N;
+    if (count < N) count++;
+    select();
+  }
+
+  //the own clock has been adjusted by us: keep the samples in line
+  void adjust(int32_t us) {
+    for (size_t i = 0; i < count; i++) samples[i].offset -= us;
+    bestOffset -= us;
+  }
+
+  void reset() {count = 0; head = 0; bestOffset = 0; bestDelay = 0; rmsJitter = 0;}
+
+  bool valid() const {return count > 0;}
+  int32_t offset() const {return bestOffset;} //add to the own clock to get the master clock
+  uint32_t delay() const {return bestDelay;} //round trip
+  uint32_t jitter() const {return rmsJitter;}
+
+private:
+  struct Sample {int32_t offset; uint32_t delay;};
+  Sample samples[N];
+  size_t head = 0;
+  size_t count = 0;
+  int32_t bestOffset = 0;
+  uint32_t bestDelay = 0;
+  uint32_t rmsJitter = 0;
+
+  void select() {
+    size_t best = 0;
+    for (size_t i = 1; i < count; i++)
+      if (samples[i].delay < samples[best].delay) best = i;
+    bestOffset = samples[best].offset;
+    bestDelay = samples[best].delay;
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      int64_t diff = (int64_t)samples[i].offset - bestOffset;
+      sum += diff * diff;
+    }
+    rmsJitter = count > 1?isqrt(sum / (count - 1)):0;
+  }
+
+  static uint32_t isqrt(uint64_t value) {
+    uint64_t root = 0, bit = 1ULL << 62;
+    while (bit > value) bit >>= 2;
+    while (bit) {
+      if (value >= root + bit) {value -= root + bit; root = (root >> 1) + bit;}
+      else root >>= 1;
+      bit >>= 2;
+    }
+    return root;
+  }
+};
+
+//ms between announces: 10 s, longer in large fleets so all instances together send at most 10 announces per second
+inline uint32_t announceBase(size_t instances) {
+  return instances * 100 > 10000?instances * 100:10000;
+}
+
+//ms: an announce has all dash values at least this often (the first announce after it), also in large fleets
+#define STARSYNC_FULL_INTERVAL 60000
+
+//with ±25% jitter (random: any random number) so instances do not announce in bursts
+inline uint32_t announceInterval(size_t instances, uint32_t random) {
+  uint32_t interval = announceBase(instances);
+  return interval - interval / 4 + random % (interval / 2 + 1);
+}
+
+//the longest announceInterval
+inline uint32_t announceMax(size_t instances) {
+  uint32_t interval = announceBase(instances);
+  return interval - interval / 4 + interval / 2;
+}
+
+//ms after the last announce an instance is considered gone: 3 announces missed (39.5 s in small fleets)
+//interval: announceMax as announced by the instance, its fleet can differ from the own one (0: not announced, use the own one)
+inline uint32_t announceExpiry(size_t instances, uint32_t interval = 0) {
+  return (interval?interval:announceMax(instances)) * 3 + 2000;
+}
+
+//the announce interval in an announce payload, 0 if not in it
+inline uint32_t announcedInterval(const uint8_t *payload, size_t payloadSize) {
+  TLVReader reader(payload, payloadSize);
+  TLVValue tlv;
+  while (reader.next(tlv))
+    if (tlv.key == STARSYNC_KEY_INTERVAL) return tlv.asUInt();
+  return 0;
+}
+
+//min-heap of deadlines (millis, wrapping) per id. A new deadline for an id does not remove the old one:
+//the caller checks if a popped deadline is still the current one for that id (lazy deletion)
+template <typename Id>
+class DeadlineHeap {
+public:
+  void push(uint32_t deadline, Id id) {
+    entries.push_back({deadline, id});
+    size_t i = entries.size() - 1;
+    while (i && before(entries[i], entries[(i - 1) / 2])) {
+      std::swap(entries[i], entries[(i - 1) / 2]);
+      i = (i - 1) / 2;
+    }
+  }
+
+  //the earliest deadline if it passed
+  bool popExpired(uint32_t now, uint32_t &deadline, Id &id) {
+    if (entries.empty() || (int32_t)(entries[0].deadline - now) > 0) return false;
+    deadline = entries[0].deadline;
+    id = entries[0].id;
+    entries[0] = entries.back();
+    entries.pop_back();
+    size_t i = 0;
+    while (true) {
+      size_t smallest = i, left = 2 * i + 1, right = left + 1;
+      if (left < entries.size() && before(entries[left], entries[smallest])) smallest = left;
+      if (right < entries.size() && before(entries[right], entries[smallest])) smallest = right;
+      if (smallest == i) break;
+      std::swap(entries[i], entries[smallest]);
+      i = smallest;
+    }
+    return true;
+  }
+
+  size_t size() const {return entries.size();}
+  void clear() {entries.clear();}
+
+private:
+  struct Entry {uint32_t deadline; Id id;};
+  std::vector<Entry> entries;
+
+  static bool before(const Entry &a, const Entry &b) {return (int32_t)(a.deadline - b.deadline) < 0;}
+};
+
+//what StarSync knows of another instance
+struct StarSyncPeer {
+  SeqTracker changes; //change messages received from this instance
+  uint32_t nackMillis = 0; //last nack sent to this instance
+  int32_t clockOffset = 0; //µs to the clock master of the group, as announced
+  uint32_t clockJitter = 0; //µs
+  uint32_t interval = 0; //max ms between its announces, as announced, 0: not announced
+  bool multicast = false; //receives group messages, as announced
+};
+
+//a value to send, see StarSync::encodeValue
+struct TLVData {
+  uint8_t type = tlvNull;
+  size_t len = 0;
+  uint8_t data[UINT8_MAX];
+};
+
+//the instance sync protocol of one instance: announce payloads, sequenced change messages, nacks and retransmits, clock sync
+//the transport, the clock and the dash variables are the virtual functions, implemented by SysModInstances (Address: IPAddress)
+//and by tools/swarmsim.cpp (Address: node id), so the simulator runs the same protocol as the devices
+template <typename Address>
+class StarSync {
+public:
+  uint32_t nacksSent = 0;
+  uint32_t retransmits = 0;
+
+  virtual ~StarSync() {}
+
+  //a dash variable changed, sent by the next sendChanges
+  void queueChange(uint16_t key) {
+    if (applyingValues) return; //received from another instance: do not echo
+    if (!changedKeys.push(key)) changedOverflow = true; //send all
+  }
+
+  //broadcasts all queued changes in one sequenced message (what does not fit goes in the next one)
+  void sendChanges() {
+    if (!changedKeys.size() && !changedOverflow) return;
+
+    uint8_t buffer[STARSYNC_MESSAGE_SIZE];
+    TLVWriter writer(buffer, sizeof(buffer), changedOverflow?STARSYNC_FULL:0);
+    writer.addUInt(STARSYNC_KEY_SEQ, ++changeSeq);
+    std::vector<uint16_t> keys;
+
+    if (changedOverflow) {
+      forValues([&](uint16_t key) {
+        if (writeValue(writer, key, true)) keys.push_back(key);
+      });
+      changedKeys.clear();
+      changedOverflow = false;
+    }
+    else {
+      uint16_t key;
+      while (changedKeys.pop(key)) {
+        if (!writeValue(writer, key, true)) {
+          changedKeys.unpop(); //next tick
+          break;
+        }
+        keys.push_back(key);
+      }
+    }
+
+    if (keys.empty()) {changeSeq--; return;}
+
+    sentChanges.add(changeSeq, keys);
+    sendToGroup(buffer, writer.length(), groupMulticast());
+  }
+
+  //asks instances with missing change messages to resend them, at most every 100ms per instance
+  void sendNacks() {
+    forGroupPeers([this](Address address, StarSyncPeer &peer) {
+      if (!peer.changes.missingBits() || localMillis() - peer.nackMillis < 100) return;
+      peer.nackMillis = localMillis();
+
+      uint8_t buffer[16];
+      TLVWriter writer(buffer, sizeof(buffer), STARSYNC_NACK);
+      writer.addUInt(STARSYNC_KEY_SEQ, peer.changes.last());
+      writer.addUInt(STARSYNC_KEY_MISSING, peer.changes.missingBits());
+      sendTo(address, buffer, writer.length());
+      nacksSent++;
+    });
+  }
+
+  //the payload of an announce: the last change message sent, the announce interval, the clock and the dash values:
+  //only the changed ones, all of them every STARSYNC_FULL_INTERVAL or when a new instance showed up (announceFull)
+  //stub: only the announce interval, for the instances which do not get the group messages (see groupMulticast)
+  size_t writeAnnounce(uint8_t *buffer, size_t size, size_t instances, bool stub = false) {
+    if (stub) {
+      TLVWriter writer(buffer, size, STARSYNC_MULTICAST);
+      writer.addUInt(STARSYNC_KEY_INTERVAL, announceMax(instances));
+      return writer.length();
+    }
+
+    bool full = announceFull || localMillis() - fullAnnounceMillis >= STARSYNC_FULL_INTERVAL;
+    TLVWriter writer(buffer, size, (full?STARSYNC_FULL:0) | (multicastJoined()?STARSYNC_MULTICAST:0));
+    writer.addUInt(STARSYNC_KEY_SEQ, changeSeq); //receivers can detect lost change messages
+    writer.addUInt(STARSYNC_KEY_INTERVAL, announceMax(instances)); //receivers expire this instance after 3 of them
+    writer.addInt(STARSYNC_KEY_OFFSET, clock.offset());
+    writer.addUInt(STARSYNC_KEY_JITTER, clock.jitter());
+    forValues([&](uint16_t key) {writeValue(writer, key, full);});
+    if (full && !writer.full()) {
+      announceFull = false;
+      fullAnnounceMillis = localMillis();
+    }
+    return writer.length();
+  }
+
+  //the payload of an announce of a peer of the own group, false if not valid
+  bool receiveAnnounce(StarSyncPeer &peer, const uint8_t *payload, size_t payloadSize) {
+    return readValues(peer, payload, payloadSize, true);
+  }
+
+  //a change, nack or clock message of a peer of the own group, received: clockMicros when received. False if not valid
+  bool receive(Address from, StarSyncPeer &peer, const uint8_t *payload, size_t payloadSize, uint32_t received) {
+    uint8_t flags = payloadSize > 2?payload[2]:0;
+    if (flags & STARSYNC_TIME) handleClock(from, payload, payloadSize, received);
+    else if (flags & STARSYNC_NACK) resendChanges(from, payload, payloadSize);
+    else return readValues(peer, payload, payloadSize, false);
+    return true;
+  }
+
+  //the peer restarted (its uptime went down): its sequence numbers start again and it missed the changes while it was down
+  void restarted(StarSyncPeer &peer) {
+    peer.changes.reset();
+    peer.nackMillis = 0;
+    announceFull = true;
+  }
+
+  //ntp style: ask the clock master its time (each second), self: this instance is the master
+  void requestClock(Address master, bool self) {
+    if (!clockMasterKnown || master != clockMaster) {
+      clock.reset();
+      clockMaster = master;
+      clockMasterKnown = true;
+    }
+    if (self) return;
+
+    uint8_t buffer[16];
+    TLVWriter writer(buffer, sizeof(buffer), STARSYNC_TIME);
+    writer.addUInt(STARSYNC_KEY_T1, clockMicros());
+    sendTo(master, buffer, writer.length());
+  }
+
+  //multicast: dash values to the group address only if all instances of the group receive them, else broadcast
+  bool groupMulticast() {
+    if (!multicastJoined()) return false;
+    bool all = true;
+    forGroupPeers([&all](Address, StarSyncPeer &peer) {if (!peer.multicast) all = false;});
+    return all;
+  }
+
+protected:
+  uint16_t changeSeq = 0; //last change message sent, start at a random number (restarted senders)
+  bool announceFull = true; //all dash values in the next announce, e.g. when a new instance showed up
+  ClockFilter<8> clock; //offset to the clock master
+  bool applyingValues = false; //received values are being set
+
+  //transport, clock and dash variables
+  virtual uint32_t localMillis() = 0;
+  virtual uint32_t clockMicros() = 0; //the clock synced with the group (own clock + timebase), µs
+  virtual void adjustClock(int32_t ms) = 0; //add to the synced clock
+  virtual void sendTo(Address to, const uint8_t *data, size_t len) = 0;
+  virtual void sendToGroup(const uint8_t *data, size_t len, bool multicast) = 0; //multicast: to the group address, else broadcast
+  virtual bool multicastJoined() = 0; //receives the messages to the group address
+  virtual void forGroupPeers(std::function<void(Address, StarSyncPeer &)> fun) = 0; //the StarSync instances of the own group, not this one
+  virtual void forValues(std::function<void(uint16_t)> fun) = 0; //the keys of all dash variables
+  virtual bool encodeValue(uint16_t key, TLVData &value) = 0; //the current value, false if unknown or too long
+  virtual void applyValue(StarSyncPeer &peer, const TLVValue &tlv, bool clear) = 0; //a received value, clear: the first of a full message
+
+private:
+  SentHistory<16> sentChanges; //to resend on a nack
+  ChangeRing<32> changedKeys; //dash variables changed since the last sendChanges
+  bool changedOverflow = false;
+  TLVDelta announceDelta; //dash values sent in previous announces
+  uint32_t fullAnnounceMillis = 0; //last announce with all dash values
+  Address clockMaster;
+  bool clockMasterKnown = false;
+
+  //add a value if changed since the last announce (or full), false if it did not fit
+  bool writeValue(TLVWriter &writer, uint16_t key, bool full) {
+    TLVData value;
+    if (!encodeValue(key, value)) return true; //nothing to send
+    if (!full && !announceDelta.changed(key, value.type, value.data, value.len)) return true;
+    if (!writer.add(key, value.type, value.data, value.len)) return false; //next message
+    announceDelta.markSent(key, value.type, value.data, value.len);
+    return true;
+  }
+
+  //update the changed values of the peer (all values if full) and track the change messages received
+  //announce: the sequence number is the last change message sent, else of the change message itself
+  bool readValues(StarSyncPeer &peer, const uint8_t *payload, size_t payloadSize, bool announce) {
+    TLVReader reader(payload, payloadSize);
+    if (announce) peer.multicast = reader.flags() & STARSYNC_MULTICAST;
+    bool cleared = false;
+
+    applyingValues = true;
+    TLVValue tlv;
+    while (reader.next(tlv)) {
+      if (tlv.key == STARSYNC_KEY_SEQ) { //first entry
+        uint16_t seq = tlv.asUInt();
+        if (reader.isFull()) peer.changes.synced(seq);
+        else if (announce) peer.changes.expect(seq);
+        else if (!peer.changes.receive(seq, reader.flags() & STARSYNC_RETRANSMIT)) break; //duplicate or outdated
+        continue;
+      }
+      if (tlv.key == STARSYNC_KEY_OFFSET) {peer.clockOffset = tlv.asInt(); continue;}
+      if (tlv.key == STARSYNC_KEY_JITTER) {peer.clockJitter = tlv.asUInt(); continue;}
+      if (tlv.key == STARSYNC_KEY_INTERVAL) {peer.interval = tlv.asUInt(); continue;}
+      if (tlv.key < 16) continue; //protocol entries of newer versions
+
+      applyValue(peer, tlv, reader.isFull() && !cleared);
+      cleared = true;
+    }
+    applyingValues = false;
+    return reader.isValid();
+  }
+
+  //resends the change messages asked for in a nack, with the current values. All values if not in the history anymore
+  void resendChanges(Address to, const uint8_t *payload, size_t payloadSize) {
+    TLVReader reader(payload, payloadSize);
+    TLVValue tlv;
+    uint16_t last = 0;
+    uint32_t missing = 0;
+    while (reader.next(tlv)) {
+      if (tlv.key == STARSYNC_KEY_SEQ) last = tlv.asUInt();
+      else if (tlv.key == STARSYNC_KEY_MISSING) missing = tlv.asUInt();
+    }
+
+    for (uint8_t bit = 0; bit < 32; bit++) {
+      if (!(missing & (1UL << bit))) continue;
+      const std::vector<uint16_t> *keys = sentChanges.find(last - bit);
+
+      uint8_t buffer[STARSYNC_MESSAGE_SIZE];
+      TLVWriter writer(buffer, sizeof(buffer), STARSYNC_RETRANSMIT | (keys?0:STARSYNC_FULL));
+      writer.addUInt(STARSYNC_KEY_SEQ, keys?last - bit:changeSeq);
+      if (keys) {
+        for (uint16_t key: *keys) writeValue(writer, key, true);
+      }
+      else
+        forValues([&](uint16_t key) {writeValue(writer, key, true);});
+      sendTo(to, buffer, writer.length());
+      retransmits++;
+
+      if (!keys) break; //all values sent
+    }
+  }
+
+  //request: answer with the own clock, response from the master: adjust the own clock
+  void handleClock(Address from, const uint8_t *payload, size_t payloadSize, uint32_t received) {
+    TLVReader reader(payload, payloadSize);
+    TLVValue tlv;
+    uint32_t t[3] = {};
+    uint8_t found = 0;
+    while (reader.next(tlv)) {
+      if (tlv.key >= STARSYNC_KEY_T1 && tlv.key <= STARSYNC_KEY_T3) {
+        t[tlv.key - STARSYNC_KEY_T1] = tlv.asUInt();
+        found |= 1 << (tlv.key - STARSYNC_KEY_T1);
+      }
+    }
+
+    if (found == 1) {
+      uint8_t buffer[32];
+      TLVWriter writer(buffer, sizeof(buffer), STARSYNC_TIME);
+      writer.addUInt(STARSYNC_KEY_T1, t[0]);
+      writer.addUInt(STARSYNC_KEY_T2, received);
+      writer.addUInt(STARSYNC_KEY_T3, clockMicros());
+      sendTo(from, buffer, writer.length());
+    }
+    else if (found == 7 && clockMasterKnown && from == clockMaster) {
+      clock.add(t[0], t[1], t[2], received);
+
+      //step if far off, else slew max 2 ms per sample so effects do not jump
+      int32_t offsetMs = clock.offset() / 1000;
+      if (offsetMs > 100 || offsetMs < -100) {
+        adjustClock(offsetMs);
+        clock.reset();
+      }
+      else if (offsetMs) {
+        int32_t step = offsetMs > 2?2:offsetMs < -2?-2:offsetMs;
+        adjustClock(step);
+        clock.adjust(step * 1000);
+      }
+    }
+  }
+};
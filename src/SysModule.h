@@ -98,6 +98,7 @@ public:
   // void (SysModule::*loopCached)() = &SysModule::loop; //use virtual cached function for speed??? tested, no difference ...
 
   unsigned long cpuTime = 0;
+  uint64_t cpuCycles = 0; //all loops since boot, under sys->countersMux
 
   explicit SysModule(const char * name) {
     this->name = name;
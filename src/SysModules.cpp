@@ -124,6 +124,7 @@ void SysModules::loop() {
   //   tenSecondMillis = millis();
   //   tenSec = true;
   // }
+  xSemaphoreTake(mdl->modelMutex, portMAX_DELAY); //given each loop: a waiting reader gets it between two loops
   for (SysModule *module:modules) {
     if (module->isEnabled && module->success) {
       uint32_t cycles = ESP.getCycleCount();
@@ -142,6 +143,9 @@ void SysModules::loop() {
         module->loop10s();
       }
       module->cpuTime = (ESP.getCycleCount() - cycles);
+      portENTER_CRITICAL(&sys->countersMux); //64 bit, read by /metrics
+      module->cpuCycles += module->cpuTime;
+      portEXIT_CRITICAL(&sys->countersMux);
     }
   }
 
@@ -168,6 +172,7 @@ void SysModules::loop() {
     isConnected = true;
     connectedChanged();
   }
+  xSemaphoreGive(mdl->modelMutex);
 }
 
 void SysModules::reboot() {
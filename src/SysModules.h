@@ -30,6 +30,8 @@ public:
 
   void connectedChanged();
 
+  const std::vector<SysModule *> &getModules() const {return modules;}
+
 private:
   std::vector<SysModule *> modules;
   // unsigned long oneSecondMillis = 0;
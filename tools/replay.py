@@ -0,0 +1,70 @@
+# @title     StarBase
+# @file      replay.py
+# @date      20241219
+# @repo      https://github.com/ewowi/StarBase, submit changes to this file as PRs to ewowi/StarBase
+# @Authors   https://github.com/ewowi/StarBase/commits/main
+# @Copyright © 2024 Github StarBase Commit Authors
+# @license   GNU GENERAL PUBLIC LICENSE Version 3, 29 June 2007
+# @license   For non GPL-v3 usage, commercial licenses must be purchased. Contact moonmodules@icloud.com
+
+# replays recorded requests against a device and shows the handler latencies of /metrics before and after
+# python3 tools/replay.py 192.168.1.213 misc/replay.txt [repeat]
+# recording: one request per line: METHOD path [body], # for comments
+
+import sys
+import time
+import urllib.request
+
+def request(ip, method, path, body = None):
+    data = body.encode() if body else None
+    req = urllib.request.Request("http://" + ip + path, data = data, method = method)
+    if data: req.add_header("Content-Type", "application/json")
+    with urllib.request.urlopen(req, timeout = 10) as response:
+        return response.read()
+
+def latencies(ip):
+    result = {}
+    for line in request(ip, "GET", "/metrics").decode().splitlines():
+        if line.startswith("starbase_handler_latency_us{"):
+            labels, value = line[len("starbase_handler_latency_us{"):].split("} ")
+            handler = labels.split('"')[1]
+            quantile = labels.split('"')[3]
+            result.setdefault(handler, {})[quantile] = int(value)
+        elif line.startswith("starbase_handler_latency_us_count{"):
+            handler = line.split('"')[1]
+            result.setdefault(handler, {})["count"] = int(line.split("} ")[1])
+    return result
+
+if len(sys.argv) < 3:
+    print("usage: replay.py <ip> <recording> [repeat]")
+    sys.exit(1)
+
+ip = sys.argv[1]
+repeat = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+
+recorded = []
+with open(sys.argv[2]) as f:
+    for line in f:
+        line = line.strip()
+        if not line or line.startswith("#"): continue
+        parts = line.split(" ", 2)
+        recorded.append((parts[0], parts[1], parts[2] if len(parts) > 2 else None))
+
+before = latencies(ip)
+start = time.time()
+errors = 0
+for i in range(repeat):
+    for method, path, body in recorded:
+        try:
+            request(ip, method, path, body)
+        except Exception as e:
+            errors += 1
+            print(method, path, e)
+elapsed = time.time() - start
+after = latencies(ip)
+
+print("%d requests in %.1f s (%.1f /s), %d errors" % (repeat * len(recorded), elapsed, repeat * len(recorded) / elapsed, errors))
+print("%-12s %8s %8s %8s %8s" % ("handler", "#", "p50 µs", "p95 µs", "p99 µs")) # percentiles since boot
+for handler, values in after.items():
+    count = values.get("count", 0) - before.get(handler, {}).get("count", 0)
+    print("%-12s %8d %8d %8d %8d" % (handler, count, values.get("0.50", 0), values.get("0.95", 0), values.get("0.99", 0)))
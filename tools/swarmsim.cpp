@@ -0,0 +1,463 @@
+/*
+   @title     StarBase
+   @file      swarmsim.cpp
+   @date      20241219
+   @repo      https://github.com/ewoudwijma/StarBase, submit changes to this file as PRs to ewowi/StarBase
+   @Authors   https://github.com/ewoudwijma/StarBase/commits/main
+   @Copyright © 2024 Github StarBase Commit Authors
+   @license   GNU GENERAL PUBLIC LICENSE Version 3, 29 June 2007
+   @license   For non GPL-v3 usage, commercial licenses must be purchased. Contact moonmodules@icloud.com
+*/
+
+//runs N instances of the instance sync protocol (SysStarSync.h, as used by SysModInstances) on an in-memory network
+//  g++ -std=gnu++11 -O2 -o swarmsim tools/swarmsim.cpp && ./swarmsim nodes=200 groups=8 loss=5 multicast=100
+//options (default): nodes (50) groups (4) loss in % (5) latency in ms (2) jitter in ms (5) seconds (120)
+//  changes per second (2) multicast: % of the nodes in multicast mode (0) restarts: nodes rebooting during the run (0) seed (1)
+//reports announce convergence, dash change propagation latency, packets and cpu per node and clock sync error
+//Node runs the StarSync engine of SysStarSync.h, the same code as SysModInstances, on an in-memory network
+
+//as on the device: loop20ms handles one packet per socket, loop1s sends clock requests and announces,
+//a socket buffers at most 32 packets, clocks start up to 10 s apart and drift up to 50 ppm
+//a restart keeps the dash values (saved model) but loses all protocol state, the node is down for 5 s
+
+#include "../src/Sys/SysStarSync.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+
+#define HEADER_SIZE 72 //UDPWLEDMessage + SysData on the device
+#define PAYLOAD_SIZE (1460 - HEADER_SIZE)
+#define SOCKET_PACKETS 32
+#define BROADCAST -1
+#define GROUP -2
+
+static uint64_t simMicros = 0; //true time
+
+static std::mt19937 rng;
+static uint32_t random32() {return rng();}
+
+struct Options {
+  int nodes = 50;
+  int groups = 4;
+  double loss = 5;
+  uint32_t latency = 2;
+  uint32_t jitter = 5;
+  uint32_t seconds = 120;
+  double changes = 2;
+  double multicast = 0;
+  int restarts = 0;
+  uint32_t seed = 1;
+} options;
+
+struct Packet {
+  uint64_t at = 0; //delivery time
+  uint64_t order = 0; //fifo for equal times
+  int from = 0;
+  int to = 0;
+  bool announce = false; //header (with the sender now) + payload, else a TLV message
+  uint32_t senderNow = 0; //announce: sysData.now (ms)
+  uint32_t senderUptime = 0; //announce: sysData.uptime (s)
+  bool group = false; //received on the multicast socket
+  std::vector<uint8_t> data;
+  bool operator<(const Packet &other) const {return at != other.at?at > other.at:order > other.order;} //min-heap
+};
+
+struct Node;
+static std::vector<Node> nodes;
+static std::priority_queue<Packet> network;
+static uint64_t packetOrder = 0;
+static std::vector<Packet> outbox; //sent this ms, delivered by the network outside the cpu time of the sender
+
+//pending change per group and key, to measure how long it takes until all members have it
+struct Propagation {
+  bool active = false;
+  bool restarted = false; //made by a node which restarted before
+  uint32_t value;
+  uint64_t start;
+};
+static std::vector<std::vector<Propagation>> propagations; //[group][key]
+static std::vector<uint32_t> latencies; //µs
+static uint32_t changesMade = 0, superseded = 0, restartedChanges = 0, restartedPropagated = 0;
+static std::vector<std::pair<int, uint16_t>> applied; //group and key of values received this ms
+
+#define KEYS 3
+static uint16_t keys[KEYS];
+
+struct Peer: StarSyncPeer {
+  uint32_t deadline = 0;
+  uint32_t uptime = 0; //s, as announced
+};
+
+//one instance: the StarSync protocol (as SysModInstances) on the in-memory network
+struct Node: StarSync<int> {
+  int id; //lower id: lower ip
+  std::string name;
+  uint32_t group;
+  int groupNr;
+  bool multicast = false; //multicast mode: joined the group address
+
+  uint64_t bootMicros = 0; //true time of the last (re)start
+  uint64_t downUntil = 0; //restarting till then
+  uint64_t skew; //µs, clocks do not start at 0
+  double drift; //ppm
+  uint32_t timebase = 0; //ms, as sys->timebase
+  uint32_t tickPhase; //ms offset of loop20ms and loop1s
+
+  std::unordered_map<uint16_t, uint32_t> values; //dash values
+  std::unordered_map<int, Peer> peers;
+  DeadlineHeap<int> expiries;
+  uint32_t nextAnnounce = 0;
+  std::deque<Packet> sockets[2]; //instance (broadcast and unicast), group (multicast)
+
+  //counters
+  uint64_t sent = 0, sentBytes = 0, received = 0, dropped = 0, expired = 0, restarts = 0;
+  uint64_t cpuNanos = 0;
+
+  uint64_t localMicros() const {uint64_t up = simMicros - bootMicros; return up + skew + (int64_t)(up * drift / 1e6);}
+  uint32_t millis() const {return localMicros() / 1000;}
+  uint32_t micros() const {return localMicros();}
+  uint32_t syncMicros() const {return micros() + timebase * 1000;}
+  uint32_t now() const {return millis() + timebase;}
+  bool down() const {return simMicros < downUntil;}
+
+  bool sameGroup(int peer) const {return group && nodes[peer].group == group;}
+
+  void send(int to, const uint8_t *data, size_t len, bool announce = false) {
+    Packet packet;
+    packet.from = id;
+    packet.to = to;
+    packet.announce = announce;
+    packet.senderNow = now();
+    packet.senderUptime = millis() / 1000;
+    packet.data.assign(data, data + len);
+    outbox.push_back(packet);
+    sent++;
+    sentBytes += len + (announce?HEADER_SIZE:0);
+  }
+
+  void setup() {
+    changeSeq = random32(); //as esp_random() in SysModInstances::setup
+  }
+
+  //as Variable::setValue of a dash variable
+  void setValue(uint16_t key, uint32_t value) {
+    if (values[key] == value) return;
+    values[key] = value;
+    if (applyingValues) {applied.push_back({groupNr, key}); return;}
+    queueChange(key);
+  }
+
+  //as a reboot: the protocol state is gone, the dash values are restored (saved model), millis() starts again
+  void restart(uint32_t downMillis) {
+    uint32_t nacks = nacksSent, resent = retransmits;
+    Node fresh;
+    static_cast<StarSync<int> &>(*this) = fresh;
+    nacksSent = nacks;
+    retransmits = resent;
+    setup();
+
+    peers.clear();
+    expiries.clear();
+    sockets[0].clear();
+    sockets[1].clear();
+    timebase = 0;
+    downUntil = simMicros + (uint64_t)downMillis * 1000;
+    bootMicros = downUntil;
+    skew = random32() % 1000000; //boot time
+    nextAnnounce = 0;
+    restarts++;
+  }
+
+  int findClockMaster() const {
+    int master = id;
+    for (auto &peer: peers)
+      if (sameGroup(peer.first) && peer.first < master) master = peer.first;
+    return master;
+  }
+
+  void renewDeadline(int peer) {
+    Peer &info = peers[peer];
+    info.deadline = millis() + announceExpiry(peers.size() + 1, info.interval);
+    expiries.push(info.deadline, peer);
+  }
+
+  void loop20ms() {
+    for (int socket = 0; socket < 2; socket++) {
+      if (sockets[socket].empty()) continue;
+      Packet packet = sockets[socket].front();
+      sockets[socket].pop_front();
+      handlePacket(packet);
+    }
+
+    sendChanges();
+    sendNacks();
+
+    uint32_t deadline;
+    int peer;
+    while (expiries.popExpired(millis(), deadline, peer)) {
+      auto found = peers.find(peer);
+      if (found == peers.end() || found->second.deadline != deadline) continue;
+      peers.erase(found);
+      expired++;
+    }
+  }
+
+  void loop1s() {
+    int master = findClockMaster();
+    requestClock(master, master == id);
+    if ((int32_t)(millis() - nextAnnounce) >= 0) {
+      sendAnnounce();
+      nextAnnounce = millis() + announceInterval(peers.size() + 1, random32());
+    }
+  }
+
+  void handlePacket(Packet &packet) {
+    received++;
+    uint32_t receivedMicros = syncMicros();
+    int from = packet.from;
+
+    if (packet.announce) { //as SysModInstances::updateInstance
+      bool found = peers.count(from);
+      Peer &peer = peers[from];
+      if (found && packet.senderUptime < peer.uptime) restarted(peer);
+      peer.uptime = packet.senderUptime;
+      peer.interval = announcedInterval(packet.data.data(), packet.data.size());
+      renewDeadline(from);
+      if (!found) announceFull = true;
+      if (sameGroup(from)) {
+        if (!clock.valid() && from == findClockMaster())
+          timebase = packet.senderNow + 3 - millis(); //PRESUMED_NETWORK_DELAY
+        if (TLVReader::isTLV(packet.data.data(), packet.data.size()))
+          receiveAnnounce(peer, packet.data.data(), packet.data.size());
+      }
+      return;
+    }
+
+    auto peer = peers.find(from);
+    if (peer == peers.end() || !sameGroup(from)) return; //changes of unknown instances are ignored till announced
+    receive(from, peer->second, packet.data.data(), packet.data.size(), receivedMicros);
+  }
+
+  void sendAnnounce() {
+    uint8_t buffer[PAYLOAD_SIZE];
+    size_t len = writeAnnounce(buffer, sizeof(buffer), peers.size() + 1);
+    if (groupMulticast()) {
+      send(GROUP, buffer, len, true);
+      send(BROADCAST, buffer, writeAnnounce(buffer, sizeof(buffer), peers.size() + 1, true), true);
+    }
+    else
+      send(BROADCAST, buffer, len, true);
+  }
+
+  //StarSync: the transport, the clock and the dash variables
+  uint32_t localMillis() override {return millis();}
+  uint32_t clockMicros() override {return syncMicros();}
+  void adjustClock(int32_t ms) override {timebase += ms;}
+  void sendTo(int to, const uint8_t *data, size_t len) override {send(to, data, len);}
+  void sendToGroup(const uint8_t *data, size_t len, bool multicast) override {send(multicast?GROUP:BROADCAST, data, len);}
+  bool multicastJoined() override {return multicast && group;}
+
+  void forGroupPeers(std::function<void(int, StarSyncPeer &)> fun) override {
+    for (auto &peer: peers)
+      if (sameGroup(peer.first)) fun(peer.first, peer.second);
+  }
+
+  void forValues(std::function<void(uint16_t)> fun) override {
+    for (uint16_t key: keys) fun(key);
+  }
+
+  bool encodeValue(uint16_t key, TLVData &value) override {
+    auto found = values.find(key);
+    if (found == values.end()) return false;
+    value.type = tlvUInt;
+    value.len = TLVWriter::encodeUInt(found->second, value.data);
+    return true;
+  }
+
+  void applyValue(StarSyncPeer &, const TLVValue &tlv, bool) override {
+    if (tlv.type == tlvUInt) setValue(tlv.key, tlv.asUInt());
+  }
+};
+
+//to one instance, all (broadcast) or the group of the sender (multicast), each receiver can lose it
+static void transmit(Packet &packet, uint32_t senderGroup) {
+  int to = packet.to;
+  for (Node &node: nodes) {
+    if (node.id == packet.from) continue;
+    if (to >= 0 && node.id != to) continue;
+    if (to == GROUP && (node.group != senderGroup || !node.multicast)) continue; //not joined
+    if (random32() % 10000 < options.loss * 100) continue; //lost
+    packet.at = simMicros + options.latency * 1000 + (options.jitter?random32() % (options.jitter * 1000):0);
+    packet.order = packetOrder++;
+    packet.to = node.id;
+    packet.group = to == GROUP;
+    network.push(packet);
+  }
+}
+
+//the change of a group and key is propagated if all members of the group have its value
+static void propagated(int groupNr, uint16_t key) {
+  Propagation &propagation = propagations[groupNr][std::find(keys, keys + KEYS, key) - keys];
+  if (!propagation.active) return;
+  for (Node &node: nodes)
+    if (node.groupNr == groupNr && node.values[key] != propagation.value) return;
+  latencies.push_back(simMicros - propagation.start);
+  if (propagation.restarted) restartedPropagated++;
+  propagation.active = false;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, double percent) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(values.size() * percent / 100))];
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t is = arg.find('=');
+    if (is == std::string::npos) {printf("usage: %s [nodes=50] [groups=4] [loss=5] [latency=2] [jitter=5] [seconds=120] [changes=2] [multicast=0..100] [restarts=0] [seed=1]\n", argv[0]); return 1;}
+    std::string key = arg.substr(0, is);
+    double value = atof(arg.substr(is + 1).c_str());
+    if (key == "nodes") options.nodes = value;
+    else if (key == "groups") options.groups = value;
+    else if (key == "loss") options.loss = value;
+    else if (key == "latency") options.latency = value;
+    else if (key == "jitter") options.jitter = value;
+    else if (key == "seconds") options.seconds = value;
+    else if (key == "changes") options.changes = value;
+    else if (key == "multicast") options.multicast = value;
+    else if (key == "restarts") options.restarts = value;
+    else if (key == "seed") options.seed = value;
+    else {printf("unknown option %s\n", key.c_str()); return 1;}
+  }
+  if (options.nodes < 2 || options.groups < 1) {printf("nodes >= 2 and groups >= 1\n"); return 1;}
+  rng.seed(options.seed);
+
+  keys[0] = tlvKey("Fixture", "brightness");
+  keys[1] = tlvKey("layers", "effect");
+  keys[2] = tlvKey("layers", "palette");
+
+  nodes.resize(options.nodes);
+  propagations.assign(options.groups, std::vector<Propagation>(KEYS));
+  for (int i = 0; i < options.nodes; i++) {
+    Node &node = nodes[i];
+    node.id = i;
+    node.groupNr = i % options.groups;
+    node.name = "group" + std::to_string(node.groupNr) + "-node" + std::to_string(i);
+    node.group = groupHash(node.name.c_str());
+    node.skew = random32() % 10000000;
+    node.drift = (double)(random32() % 101) - 50;
+    node.tickPhase = random32() % 1000;
+    node.multicast = random32() % 10000 < options.multicast * 100;
+    node.setup();
+    node.nextAnnounce = node.millis() + random32() % 10000; //not all booted at the same time
+    for (uint16_t key: keys) node.values[key] = 0;
+  }
+
+  printf("swarmsim nodes:%d groups:%d loss:%g%% latency:%u ms jitter:%u ms changes:%g/s multicast:%g%% restarts:%d seconds:%u\n",
+    options.nodes, options.groups, options.loss, options.latency, options.jitter, options.changes, options.multicast, options.restarts, options.seconds);
+
+  uint64_t end = (uint64_t)options.seconds * 1000000;
+  uint64_t changeEvery = options.changes > 0?1000000 / options.changes:0;
+  uint64_t nextChange = 20000000; //after discovery
+  uint64_t convergence = 0;
+  std::vector<uint32_t> clockErrors; //µs
+  uint32_t nextValue = 1;
+
+  //restarts between 20 s and 30 s before the end, so the changes made after them can still propagate
+  std::vector<std::pair<uint64_t, int>> restartAt; //true time, node
+  if (options.seconds > 50)
+    for (int i = 0; i < options.restarts; i++)
+      restartAt.push_back({20000000 + (uint64_t)(random32() % ((options.seconds - 50) * 1000)) * 1000, (int)(random32() % options.nodes)});
+  std::sort(restartAt.begin(), restartAt.end());
+  size_t nextRestart = 0;
+
+  for (simMicros = 0; simMicros < end; simMicros += 1000) {
+    while (!network.empty() && network.top().at <= simMicros) {
+      Packet packet = network.top();
+      network.pop();
+      if (nodes[packet.to].down()) continue; //lost
+      std::deque<Packet> &socket = nodes[packet.to].sockets[packet.group];
+      if (socket.size() >= SOCKET_PACKETS) nodes[packet.to].dropped++;
+      else socket.push_back(packet);
+    }
+
+    while (nextRestart < restartAt.size() && restartAt[nextRestart].first <= simMicros)
+      nodes[restartAt[nextRestart++].second].restart(5000);
+
+    if (changeEvery && simMicros >= nextChange) {
+      Node &node = nodes[random32() % options.nodes];
+      int key = random32() % KEYS;
+      Propagation &propagation = propagations[node.groupNr][key];
+      if (propagation.active) {
+        superseded++;
+        if (propagation.restarted) restartedChanges--; //only count the ones which can propagate
+      }
+      propagation.active = true;
+      propagation.restarted = node.restarts && !node.down();
+      if (propagation.restarted) restartedChanges++;
+      propagation.value = nextValue;
+      propagation.start = simMicros;
+      changesMade++;
+      node.setValue(keys[key], nextValue++);
+      nextChange += changeEvery;
+    }
+
+    uint32_t ms = simMicros / 1000;
+    for (Node &node: nodes) {
+      if (node.down() || ((ms + node.tickPhase) % 20 && (ms + node.tickPhase) % 1000)) continue;
+      auto start = std::chrono::steady_clock::now();
+      if ((ms + node.tickPhase) % 20 == 0) node.loop20ms();
+      if ((ms + node.tickPhase) % 1000 == 0) node.loop1s();
+      node.cpuNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    for (Packet &packet: outbox) transmit(packet, nodes[packet.from].group);
+    outbox.clear();
+    for (auto &value: applied) propagated(value.first, value.second);
+    applied.clear();
+
+    if (!convergence && ms % 100 == 0) {
+      bool all = true;
+      for (Node &node: nodes) if ((int)node.peers.size() < options.nodes - 1) {all = false; break;} //restarted nodes discover again
+      if (all) convergence = simMicros;
+    }
+
+    if (ms % 1000 == 0 && simMicros >= end / 2) { //clock error after settling
+      for (Node &node: nodes) {
+        Node &master = nodes[node.findClockMaster()];
+        if (master.id != node.id && !node.down() && !master.down()) clockErrors.push_back(std::abs((int32_t)(node.syncMicros() - master.syncMicros())));
+      }
+    }
+  }
+
+  uint32_t notConverged = 0;
+  for (auto &group: propagations) for (Propagation &propagation: group) if (propagation.active) notConverged++;
+
+  uint64_t sent = 0, sentBytes = 0, received = 0, dropped = 0, expired = 0, nacks = 0, retransmits = 0, cpuNanos = 0, restarts = 0;
+  for (Node &node: nodes) {
+    sent += node.sent; sentBytes += node.sentBytes; received += node.received; dropped += node.dropped;
+    expired += node.expired; nacks += node.nacksSent; retransmits += node.retransmits; cpuNanos += node.cpuNanos;
+    restarts += node.restarts;
+  }
+  double nodeSeconds = (double)options.nodes * options.seconds;
+
+  if (convergence) printf("announce convergence: %.1f s\n", convergence / 1e6);
+  else printf("announce convergence: not reached\n");
+  printf("dash changes: %u, propagated %zu (p50 %.1f ms, p95 %.1f ms, max %.1f ms), superseded %u, not converged %u\n",
+    changesMade, latencies.size(), percentile(latencies, 50) / 1e3, percentile(latencies, 95) / 1e3, percentile(latencies, 100) / 1e3, superseded, notConverged);
+  printf("per node per s: sent %.2f packets %.0f bytes, processed %.2f packets, socket drops %.2f\n",
+    sent / nodeSeconds, sentBytes / nodeSeconds, received / nodeSeconds, dropped / nodeSeconds);
+  printf("cpu per node: %.1f µs/s (host)\n", cpuNanos / 1e3 / nodeSeconds);
+  printf("clock sync error: p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", percentile(clockErrors, 50) / 1e3, percentile(clockErrors, 95) / 1e3, percentile(clockErrors, 100) / 1e3);
+  printf("nacks %llu, retransmits %llu, expired %llu\n", (unsigned long long)nacks, (unsigned long long)retransmits, (unsigned long long)expired);
+  if (options.restarts)
+    printf("restarts %llu: changes by restarted nodes %u, propagated %u\n", (unsigned long long)restarts, restartedChanges, restartedPropagated);
+  return 0;
+}